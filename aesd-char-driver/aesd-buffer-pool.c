@@ -0,0 +1,167 @@
+/**
+ * @file aesd-buffer-pool.c
+ * @brief Power of two size class allocator for aesdchar record buffers
+ *
+ * Records are staged in a buffer from the smallest class that fits and move to the
+ * next class when a partial write outgrows it, so a record arriving in K chunks is
+ * copied O(log size) times instead of K times. Each class has its own kmem_cache and
+ * a small stash of buffers released by eviction, which the next record reuses without
+ * going back to the slab allocator.
+ *
+ * @author Aamir Suhail Burhan
+ * @date 2026-10-19
+ *
+ */
+
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include "aesd-buffer-pool.h"
+
+struct aesd_pool_class
+{
+	struct kmem_cache *cache;
+	spinlock_t lock;	/* Protects the stash, also taken by the reclaim work */
+	void *stash[AESD_POOL_STASH_DEPTH];
+	unsigned int stashed;
+	char name[24];
+};
+
+static struct aesd_pool_class aesd_pool_classes[AESD_POOL_CLASSES];
+
+/*
+ * Returns the class index for a buffer of @param capacity bytes, or -1 when the
+ * capacity is above the largest class
+ */
+static int aesd_pool_class_index(size_t capacity)
+{
+	int shift = ilog2(capacity);
+
+	if (shift > AESD_POOL_MAX_SHIFT)
+		return -1;
+	return shift - AESD_POOL_MIN_SHIFT;
+}
+
+/*
+ * Returns the capacity of the buffer holding @param size bytes, 0 for an empty buffer
+ */
+size_t aesd_pool_capacity(size_t size)
+{
+	if (size == 0)
+		return 0;
+	if (size <= (1UL << AESD_POOL_MIN_SHIFT))
+		return 1UL << AESD_POOL_MIN_SHIFT;
+	return roundup_pow_of_two(size);
+}
+
+/*
+ * Allocates a buffer able to hold @param size bytes, reusing a stashed buffer of the
+ * same class when one is available
+ * @return the buffer, NULL if memory could not be allocated
+ */
+char *aesd_pool_alloc(size_t size)
+{
+	size_t capacity = aesd_pool_capacity(size);
+	int index = aesd_pool_class_index(capacity);
+	struct aesd_pool_class *class;
+	void *buffptr = NULL;
+
+	if (index < 0)
+		return kvmalloc(capacity, GFP_KERNEL);
+
+	class = &aesd_pool_classes[index];
+
+	spin_lock(&class->lock);
+	if (class->stashed > 0)
+		buffptr = class->stash[--class->stashed];
+	spin_unlock(&class->lock);
+
+	if (!buffptr)
+		buffptr = kmem_cache_alloc(class->cache, GFP_KERNEL);
+	return buffptr;
+}
+
+/*
+ * Releases @param buffptr which holds @param size bytes. The buffer is stashed for reuse
+ * while the stash of its class has room.
+ */
+void aesd_pool_free(const char *buffptr, size_t size)
+{
+	size_t capacity = aesd_pool_capacity(size);
+	int index = aesd_pool_class_index(capacity);
+	struct aesd_pool_class *class;
+
+	if (!buffptr)
+		return;
+
+	if (index < 0)
+	{
+		kvfree(buffptr);
+		return;
+	}
+
+	class = &aesd_pool_classes[index];
+
+	spin_lock(&class->lock);
+	if (class->stashed < AESD_POOL_STASH_DEPTH)
+	{
+		class->stash[class->stashed++] = (void *)buffptr;
+		buffptr = NULL;
+	}
+	spin_unlock(&class->lock);
+
+	if (buffptr)
+		kmem_cache_free(class->cache, (void *)buffptr);
+}
+
+/*
+ * Releases every stashed buffer and destroys the class caches
+ */
+void aesd_pool_exit(void)
+{
+	int i;
+
+	for (i = 0; i < AESD_POOL_CLASSES; i++)
+	{
+		struct aesd_pool_class *class = &aesd_pool_classes[i];
+
+		if (!class->cache)
+			continue;
+
+		while (class->stashed > 0)
+			kmem_cache_free(class->cache, class->stash[--class->stashed]);
+
+		kmem_cache_destroy(class->cache);
+		class->cache = NULL;
+	}
+}
+
+/*
+ * Creates one kmem_cache per size class
+ * @return 0 on success, -ENOMEM if a cache could not be created
+ */
+int aesd_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < AESD_POOL_CLASSES; i++)
+	{
+		struct aesd_pool_class *class = &aesd_pool_classes[i];
+		unsigned int size = 1U << (AESD_POOL_MIN_SHIFT + i);
+
+		spin_lock_init(&class->lock);
+		class->stashed = 0;
+		snprintf(class->name, sizeof(class->name), "aesdchar-%u", size);
+
+		class->cache = kmem_cache_create(class->name, size, 0, SLAB_HWCACHE_ALIGN, NULL);
+		if (!class->cache)
+		{
+			printk(KERN_ERR "aesdchar: can't create the %u byte buffer cache\n", size);
+			aesd_pool_exit();
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
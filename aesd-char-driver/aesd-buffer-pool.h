@@ -0,0 +1,42 @@
+/*
+ * aesd-buffer-pool.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Aamir Suhail Burhan
+ *
+ *  @brief Power of two size class allocator for aesdchar record buffers
+ */
+
+#ifndef AESD_BUFFER_POOL_H
+#define AESD_BUFFER_POOL_H
+
+#include <linux/types.h>
+
+/**
+ * Smallest size class is 1 << AESD_POOL_MIN_SHIFT bytes, each following class doubles
+ * up to 1 << AESD_POOL_MAX_SHIFT bytes. Larger records fall back to kvmalloc.
+ */
+#define AESD_POOL_MIN_SHIFT 6
+#define AESD_POOL_MAX_SHIFT 13
+#define AESD_POOL_CLASSES (AESD_POOL_MAX_SHIFT - AESD_POOL_MIN_SHIFT + 1)
+
+/**
+ * Number of freed buffers kept per class for reuse by the next allocation
+ */
+#define AESD_POOL_STASH_DEPTH 16
+
+/**
+ * The capacity of a pool buffer is a function of the number of bytes it holds, so a
+ * buffer is always returned with the size of its contents rather than its capacity.
+ */
+extern size_t aesd_pool_capacity(size_t size);
+
+extern char *aesd_pool_alloc(size_t size);
+
+extern void aesd_pool_free(const char *buffptr, size_t size);
+
+extern int aesd_pool_init(void);
+
+extern void aesd_pool_exit(void);
+
+#endif /* AESD_BUFFER_POOL_H */
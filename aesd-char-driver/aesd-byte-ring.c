@@ -0,0 +1,75 @@
+/**
+ * @file aesd-byte-ring.c
+ * @brief Preallocated byte ring holding aesdchar records back to back
+ *
+ * The ring is allocated once, page by page, and mapped twice in a row into the kernel
+ * address space. A record which wraps around the end of the ring is then still one
+ * contiguous range, so entries point straight into the ring and every reader of an
+ * entry buffer works unchanged. Records are staged elsewhere and copied in when they
+ * are committed, the ring only stores them.
+ *
+ * @author Aamir Suhail Burhan
+ * @date 2026-10-19
+ *
+ */
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include "aesd-byte-ring.h"
+
+/*
+ * Allocates @param ring with @param size bytes, rounded up to a power of two pages.
+ * The pages are zeroed as they may be mapped to userspace.
+ * @return 0 on success, -ENOMEM if the pages or their mapping could not be allocated
+ */
+int aesd_byte_ring_init(struct aesd_byte_ring *ring, size_t size)
+{
+	unsigned int i;
+
+	memset(ring, 0, sizeof(*ring));
+	size = roundup_pow_of_two(max_t(size_t, size, PAGE_SIZE));
+
+	ring->nr_pages = size >> PAGE_SHIFT;
+	ring->pages = kvmalloc_array(2 * ring->nr_pages, sizeof(struct page *), GFP_KERNEL | __GFP_ZERO);
+	if (!ring->pages)
+		return -ENOMEM;
+
+	for (i = 0; i < ring->nr_pages; i++)
+	{
+		ring->pages[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (!ring->pages[i])
+			goto fail;
+		ring->pages[ring->nr_pages + i] = ring->pages[i];
+	}
+
+	ring->data = vmap(ring->pages, 2 * ring->nr_pages, VM_MAP, PAGE_KERNEL);
+	if (!ring->data)
+		goto fail;
+
+	ring->size = size;
+	return 0;
+
+fail:
+	aesd_byte_ring_exit(ring);
+	return -ENOMEM;
+}
+
+void aesd_byte_ring_exit(struct aesd_byte_ring *ring)
+{
+	unsigned int i;
+
+	if (ring->data)
+		vunmap(ring->data);
+
+	for (i = 0; ring->pages && (i < ring->nr_pages); i++)
+	{
+		if (ring->pages[i])
+			__free_page(ring->pages[i]);
+	}
+
+	kvfree(ring->pages);
+	memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,41 @@
+/*
+ * aesd-byte-ring.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Aamir Suhail Burhan
+ *
+ *  @brief Preallocated byte ring holding aesdchar records back to back
+ */
+
+#ifndef AESD_BYTE_RING_H
+#define AESD_BYTE_RING_H
+
+#include <linux/types.h>
+
+struct page;
+
+/**
+ * size bytes of pages mapped twice in a row at data, so any size bytes starting inside
+ * the first mapping are contiguous. Stream position p lives at data[p & (size - 1)].
+ */
+struct aesd_byte_ring
+{
+	char *data;
+	size_t size;
+	struct page **pages;
+	unsigned int nr_pages;
+};
+
+/**
+ * @return the address of stream position @param position in @param ring
+ */
+static inline char *aesd_byte_ring_at(const struct aesd_byte_ring *ring, uint64_t position)
+{
+	return ring->data + (position & (ring->size - 1));
+}
+
+extern int aesd_byte_ring_init(struct aesd_byte_ring *ring, size_t size);
+
+extern void aesd_byte_ring_exit(struct aesd_byte_ring *ring);
+
+#endif /* AESD_BYTE_RING_H */
@@ -0,0 +1,180 @@
+/**
+ * @file aesd-circular-buffer-soa.c
+ * @brief Structure of arrays variant of the circular buffer implementation
+ *
+ * @author Aamir Suhail Burhan
+ * @date 2026-10-19
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#else
+#include <string.h>
+#endif
+
+#include "aesd-circular-buffer-soa.h"
+
+/**
+ * @return the number of @param count positions in @param start at or before @param position.
+ * Branchless so that the loop vectorizes where SIMD is available.
+ */
+static inline uint32_t aesd_soa_count_at_or_before(const uint64_t *start, uint32_t count, uint64_t position)
+{
+	uint32_t found = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++)
+		found += (start[i] <= position);
+	return found;
+}
+
+/**
+ * @return the number of entries stored from out_offs to the end of the arrays
+ */
+static inline uint32_t aesd_soa_first_run(const struct aesd_circular_buffer_soa *buffer, uint32_t count)
+{
+	uint32_t run = buffer->capacity - buffer->out_offs;
+
+	return (count < run) ? count : run;
+}
+
+/**
+ * @return the number of entries held by @param buffer
+ */
+static inline uint32_t aesd_soa_count(const struct aesd_circular_buffer_soa *buffer)
+{
+	if (buffer->full)
+		return buffer->capacity;
+	if (buffer->in_offs >= buffer->out_offs)
+		return buffer->in_offs - buffer->out_offs;
+	return buffer->capacity - buffer->out_offs + buffer->in_offs;
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param char_offset the zero referenced character index if all buffer strings were concatenated end to end
+ * @param entry_offset_byte_rtn the byte within the returned entry corresponding to char_offset
+ * @return the array index of the entry holding char_offset, -1 if not enough data is written.
+ * Binary search down to AESD_SOA_SCAN_WINDOW entries then a branchless scan.
+ */
+long aesd_circular_buffer_soa_find_entry_offset_for_fpos(const struct aesd_circular_buffer_soa *buffer,
+		size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+	uint32_t count = aesd_soa_count(buffer);
+	uint32_t first_run = aesd_soa_first_run(buffer, count);
+	uint64_t position = buffer->base + char_offset;
+	uint32_t low, high, index;
+
+	if (char_offset >= (buffer->tail - buffer->base))
+		return -1;
+
+	// Both runs are sorted, the wrapped run holds the newer entries
+	if ((count > first_run) && (buffer->start[0] <= position))
+	{
+		low = 0;
+		high = count - first_run;
+	}
+	else
+	{
+		low = buffer->out_offs;
+		high = buffer->out_offs + first_run;
+	}
+
+	// start[low] <= position always holds
+	while ((high - low) > AESD_SOA_SCAN_WINDOW)
+	{
+		uint32_t middle = low + ((high - low) / 2);
+
+		if (buffer->start[middle] <= position)
+			low = middle;
+		else
+			high = middle;
+	}
+
+	index = low + aesd_soa_count_at_or_before(&buffer->start[low], high - low, position) - 1;
+	*entry_offset_byte_rtn = position - buffer->start[index];
+	return index;
+}
+
+/**
+ * Same as aesd_circular_buffer_soa_find_entry_offset_for_fpos() with a branchless scan of
+ * every held entry instead of a binary search, O(n) but without unpredictable branches.
+ */
+long aesd_circular_buffer_soa_scan_entry_offset_for_fpos(const struct aesd_circular_buffer_soa *buffer,
+		size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+	uint32_t count = aesd_soa_count(buffer);
+	uint32_t first_run = aesd_soa_first_run(buffer, count);
+	uint64_t position = buffer->base + char_offset;
+	uint32_t found;
+	uint32_t index;
+
+	if (char_offset >= (buffer->tail - buffer->base))
+		return -1;
+
+	found = aesd_soa_count_at_or_before(&buffer->start[buffer->out_offs], first_run, position) +
+		aesd_soa_count_at_or_before(buffer->start, count - first_run, position);
+
+	index = buffer->out_offs + found - 1;
+	if (index >= buffer->capacity)
+		index -= buffer->capacity;
+
+	*entry_offset_byte_rtn = position - buffer->start[index];
+	return index;
+}
+
+/**
+ * Adds an entry of @param size bytes at @param buffptr to @param buffer, overwriting the oldest
+ * entry when the buffer is full. Any necessary locking must be handled by the caller.
+ */
+void aesd_circular_buffer_soa_add_entry(struct aesd_circular_buffer_soa *buffer, const char *buffptr, size_t size)
+{
+	uint32_t slot = buffer->in_offs;
+
+	if (buffer->full)
+		buffer->base += buffer->size[slot];
+
+	buffer->buffptr[slot] = buffptr;
+	buffer->size[slot] = size;
+	buffer->start[slot] = buffer->tail;
+	buffer->tail += size;
+
+	slot++;
+	if (buffer->mask)
+		slot &= buffer->mask;
+	else if (slot == buffer->capacity)
+		slot = 0;
+
+	if (buffer->full)
+		buffer->out_offs = slot;
+	buffer->in_offs = slot;
+
+	if (buffer->in_offs == buffer->out_offs)
+		buffer->full = true;
+}
+
+/**
+ * Initializes @param buffer to an empty buffer of @param capacity entries using the caller
+ * allocated @param start, @param size and @param buffptr arrays.
+ * Return value: 0 on success, -1 if capacity is 0
+ */
+int aesd_circular_buffer_soa_init(struct aesd_circular_buffer_soa *buffer, uint64_t *start, size_t *size,
+		const char **buffptr, uint32_t capacity)
+{
+	if (capacity == 0)
+		return -1;
+
+	memset(buffer, 0, sizeof(struct aesd_circular_buffer_soa));
+	memset(start, 0, capacity * sizeof(uint64_t));
+	memset(size, 0, capacity * sizeof(size_t));
+	memset(buffptr, 0, capacity * sizeof(const char *));
+
+	buffer->start = start;
+	buffer->size = size;
+	buffer->buffptr = buffptr;
+	buffer->capacity = capacity;
+	if ((capacity & (capacity - 1)) == 0)
+		buffer->mask = capacity - 1;
+	return 0;
+}
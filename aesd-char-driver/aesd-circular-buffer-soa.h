@@ -0,0 +1,64 @@
+/*
+ * aesd-circular-buffer-soa.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Aamir Suhail Burhan
+ *
+ *  @brief Structure of arrays variant of aesd_circular_buffer
+ *
+ *  Positions, sizes and pointers live in separate arrays so a lookup only touches the
+ *  position array, and the head/tail fields written by every add share one cache line.
+ *  Lookups binary search down to a small window which is then counted with a branchless
+ *  loop the compiler can vectorize. Compare with the default layout using "make bench".
+ */
+
+#ifndef AESD_CIRCULAR_BUFFER_SOA_H
+#define AESD_CIRCULAR_BUFFER_SOA_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <stdbool.h>
+#endif
+
+#define AESD_CACHE_LINE_SIZE 64
+
+/**
+ * Entries left to the branchless scan once the binary search has narrowed the range
+ */
+#define AESD_SOA_SCAN_WINDOW 32
+
+struct aesd_circular_buffer_soa
+{
+    /**
+     * Same meaning as in struct aesd_circular_buffer
+     */
+    uint32_t in_offs;
+    uint32_t out_offs;
+    uint32_t capacity;
+    uint32_t mask;
+    bool full;
+    uint64_t base;
+    uint64_t tail;
+    /**
+     * capacity entries each, allocated by and with a lifetime managed by the caller
+     */
+    uint64_t *start;
+    size_t *size;
+    const char **buffptr;
+} __attribute__((aligned(AESD_CACHE_LINE_SIZE)));
+
+extern long aesd_circular_buffer_soa_find_entry_offset_for_fpos(const struct aesd_circular_buffer_soa *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn);
+
+extern long aesd_circular_buffer_soa_scan_entry_offset_for_fpos(const struct aesd_circular_buffer_soa *buffer,
+            size_t char_offset, size_t *entry_offset_byte_rtn);
+
+extern void aesd_circular_buffer_soa_add_entry(struct aesd_circular_buffer_soa *buffer, const char *buffptr, size_t size);
+
+extern int aesd_circular_buffer_soa_init(struct aesd_circular_buffer_soa *buffer, uint64_t *start, size_t *size,
+            const char **buffptr, uint32_t capacity);
+
+#endif /* AESD_CIRCULAR_BUFFER_SOA_H */
@@ -32,35 +32,85 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
 	/**
 	 * TODO: implement per description
 	 */
-	size_t bytes_read = 0;
-	uint8_t index = buffer->out_offs;
+	uint64_t position;
+	uint32_t low = 0;
+	uint32_t high;
+	uint32_t index;
 
 	if(buffer == NULL)
 		return NULL;
 
-	while(bytes_read <= char_offset)
+	// Return null when position is out of range
+	if(char_offset >= aesd_circular_buffer_size(buffer))
+		return NULL;
+
+	position = buffer->base + char_offset;
+	high = aesd_circular_buffer_count(buffer) - 1;
+
+	// Binary search for the newest entry starting at or before position
+	while(low < high)
 	{
-		// Check if entry is valid
-		if(buffer->entry[index].buffptr != NULL)
-		{
-			size_t entry_size = buffer->entry[index].size;
-
-			// Check if updated total bytes read is greater than concatenated length of the entries
-			if(bytes_read + entry_size > char_offset)
-			{
-				*entry_offset_byte_rtn = char_offset - bytes_read;
-				return &buffer->entry[index];
-			}
-			bytes_read += entry_size;
-		}
-		index = (index+1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-
-		if(index == buffer->in_offs)
-			break;
+		uint32_t middle = low + ((high - low + 1) / 2);
+
+		if(buffer->entry[aesd_circular_buffer_advance(buffer, buffer->out_offs, middle)].start <= position)
+			low = middle;
+		else
+			high = middle - 1;
 	}
 
-	// Return null when position is out of range
-	return NULL;
+	index = aesd_circular_buffer_advance(buffer, buffer->out_offs, low);
+	*entry_offset_byte_rtn = position - buffer->entry[index].start;
+	return &buffer->entry[index];
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param time_ns the commit time to search for, in ns
+ * @param realtime compares the CLOCK_REALTIME times of the entries instead of their CLOCK_MONOTONIC ones,
+ *      which are only ordered as long as the realtime clock was not set back
+ * @return the number of the oldest entry committed at or after time_ns, 0 being the oldest entry,
+ * or the number of entries held if every entry is older
+ */
+uint32_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+		uint64_t time_ns, bool realtime)
+{
+	uint32_t low = 0;
+	uint32_t high = aesd_circular_buffer_count(buffer);
+
+	// Binary search for the first entry which is not older than time_ns
+	while(low < high)
+	{
+		uint32_t middle = low + ((high - low) / 2);
+		struct aesd_buffer_entry *entry = &buffer->entry[aesd_circular_buffer_advance(buffer, buffer->out_offs, middle)];
+
+		if((realtime ? entry->real_ns : entry->mono_ns) < time_ns)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+/**
+ * @param buffer the buffer holding the entry.  Any necessary locking must be performed by caller.
+ * @param entry_number the zero referenced entry to return, 0 being the oldest entry
+ * @param char_offset_rtn is a pointer specifying a location to store the char offset of the first byte of
+ *      the returned entry if all buffer strings were concatenated end to end.  May be NULL.
+ * @return the entry numbered entry_number, or NULL if the buffer holds fewer entries
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_entry_at(struct aesd_circular_buffer *buffer,
+		uint32_t entry_number, size_t *char_offset_rtn)
+{
+	struct aesd_buffer_entry *entry;
+
+	if(entry_number >= aesd_circular_buffer_count(buffer))
+		return NULL;
+
+	entry = &buffer->entry[aesd_circular_buffer_advance(buffer, buffer->out_offs, entry_number)];
+	if(char_offset_rtn)
+		*char_offset_rtn = entry->start - buffer->base;
+	return entry;
 }
 
 /**
@@ -77,16 +127,27 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
 	 * TODO: implement per description
 	 */
 
+	// The overwritten oldest entry leaves the concatenated range
+	if (buffer->full)
+	{
+		buffer->base += buffer->entry[buffer->in_offs].size;
+		buffer->base_seq++;
+	}
+
 	// Copy the new entry into circular buffer
 	buffer->entry[buffer->in_offs].buffptr = add_entry->buffptr;
     	buffer->entry[buffer->in_offs].size = add_entry->size;
+	buffer->entry[buffer->in_offs].start = buffer->tail;
+	buffer->entry[buffer->in_offs].mono_ns = add_entry->mono_ns;
+	buffer->entry[buffer->in_offs].real_ns = add_entry->real_ns;
+	buffer->tail += add_entry->size;
 
-	// Increment the in_offs for new entry and perform % for overflow check
-        buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+	// Increment the in_offs for new entry, wrapping at the capacity
+        buffer->in_offs = aesd_circular_buffer_next(buffer, buffer->in_offs);
 
 	// If buffer is full, update the out_offset to overwrite the oldest entry
         if (buffer->full)
-                buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+                buffer->out_offs = aesd_circular_buffer_next(buffer, buffer->out_offs);
 
 	// If the offsets are equal, update the buffer full status 
 	if (buffer->in_offs == buffer->out_offs) 
@@ -94,10 +155,60 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
 
 }
 
+/**
+ * Removes the oldest entry of @param buffer and stores it in @param removed_entry_rtn.
+ * Memory referenced by the removed entry is still owned by the caller.
+ * Any necessary locking must be handled by the caller
+ * Return value: true if an entry was removed, false if the buffer was empty
+ */
+bool aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed_entry_rtn)
+{
+	struct aesd_buffer_entry *oldest_entry;
+
+	if (!buffer->full && (buffer->in_offs == buffer->out_offs))
+		return false;
+
+	oldest_entry = &buffer->entry[buffer->out_offs];
+	*removed_entry_rtn = *oldest_entry;
+	buffer->base += oldest_entry->size;
+	buffer->base_seq++;
+	oldest_entry->buffptr = NULL;
+	oldest_entry->size = 0;
+
+	buffer->out_offs = aesd_circular_buffer_next(buffer, buffer->out_offs);
+	buffer->full = false;
+	return true;
+}
+
 /**
  * Initializes the circular buffer described by @param buffer to an empty struct
+ * holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
  */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
 	memset(buffer,0,sizeof(struct aesd_circular_buffer));
+	buffer->entry = buffer->default_entry;
+	buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * Initializes @param buffer to an empty struct holding @param capacity entries stored in
+ * @param entries, an array allocated by and with a lifetime managed by the caller.
+ * Return value: 0 on success, -1 if capacity is 0 or above AESDCHAR_MAX_CAPACITY
+ */
+int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer,
+		struct aesd_buffer_entry *entries, uint32_t capacity)
+{
+	if ((capacity == 0) || (capacity > AESDCHAR_MAX_CAPACITY))
+		return -1;
+
+	memset(buffer,0,sizeof(struct aesd_circular_buffer));
+	memset(entries,0,capacity * sizeof(struct aesd_buffer_entry));
+	buffer->entry = entries;
+	buffer->capacity = capacity;
+
+	// Power of two capacities wrap with a mask instead of a compare
+	if ((capacity & (capacity - 1)) == 0)
+		buffer->mask = capacity - 1;
+	return 0;
 }
@@ -16,7 +16,14 @@
 #include <stdbool.h>
 #endif
 
+/**
+ * Default number of entries, used by aesd_circular_buffer_init()
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
+/**
+ * Upper bound for the capacity passed to aesd_circular_buffer_init_capacity()
+ */
+#define AESDCHAR_MAX_CAPACITY (1U << 20)
 
 struct aesd_buffer_entry
 {
@@ -28,44 +35,149 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Position of the first byte in the stream of every entry ever added, set by
+     * aesd_circular_buffer_add_entry()
+     */
+    uint64_t start;
+    /**
+     * CLOCK_MONOTONIC and CLOCK_REALTIME times of the commit in ns, set by the caller
+     */
+    uint64_t mono_ns;
+    uint64_t real_ns;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of capacity entries for the most recent write operations
+     */
+    struct aesd_buffer_entry *entry;
+    /**
+     * Number of entries in the entry array
+     */
+    uint32_t capacity;
+    /**
+     * capacity - 1 when capacity is a power of two, which lets offsets wrap with a mask,
+     * 0 otherwise
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint32_t mask;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Stream position of the oldest entry, char offset 0 of the buffer
+     */
+    uint64_t base;
+    /**
+     * Stream position following the newest entry
+     */
+    uint64_t tail;
+    /**
+     * Sequence number of the oldest entry, every added entry takes the one after the newest
+     */
+    uint64_t base_seq;
+    /**
+     * Entry storage used when the buffer is set up by aesd_circular_buffer_init()
+     */
+    struct aesd_buffer_entry default_entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
 };
 
+/**
+ * @return the entry index following @param index in @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_next(const struct aesd_circular_buffer *buffer, uint32_t index)
+{
+    if (buffer->mask)
+        return (index + 1) & buffer->mask;
+    return ((index + 1) == buffer->capacity) ? 0 : (index + 1);
+}
+
+/**
+ * @return the entry index @param distance entries after @param index in @param buffer,
+ * @param distance must be below the capacity
+ */
+static inline uint32_t aesd_circular_buffer_advance(const struct aesd_circular_buffer *buffer, uint32_t index,
+            uint32_t distance)
+{
+    index += distance;
+    if (buffer->mask)
+        return index & buffer->mask;
+    return (index >= buffer->capacity) ? (index - buffer->capacity) : index;
+}
+
+/**
+ * @return the number of bytes held by @param buffer when all entries are concatenated
+ */
+static inline size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->tail - buffer->base;
+}
+
+/**
+ * @return the number of entries held by @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return buffer->capacity;
+    if (buffer->in_offs >= buffer->out_offs)
+        return buffer->in_offs - buffer->out_offs;
+    return buffer->capacity - buffer->out_offs + buffer->in_offs;
+}
+
+/**
+ * @return the sequence number the next entry added to @param buffer will take
+ */
+static inline uint64_t aesd_circular_buffer_next_seq(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->base_seq + aesd_circular_buffer_count(buffer);
+}
+
+/**
+ * @return the number of entry index @param index counted from the oldest entry of @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_entry_number(const struct aesd_circular_buffer *buffer, uint32_t index)
+{
+    return (index >= buffer->out_offs) ? (index - buffer->out_offs) : (buffer->capacity - buffer->out_offs + index);
+}
+
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
+extern uint32_t aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t time_ns, bool realtime);
+
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_entry_at(struct aesd_circular_buffer *buffer,
+            uint32_t entry_number, size_t *char_offset_rtn);
+
+extern bool aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer, struct aesd_buffer_entry *removed_entry_rtn);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern int aesd_circular_buffer_init_capacity(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *entries, uint32_t capacity);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +186,7 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->capacity; \
             index++, entryptr=&((buffer)->entry[index]))
 
 
@@ -0,0 +1,211 @@
+/**
+ * @file aesd-mmap.c
+ * @brief Read-only view of the newest aesdchar records which userspace can mmap
+ *
+ * Every committed record is also copied into a data region indexed by its stream
+ * position, or found there in place when records are stored in the byte ring, and
+ * described in a record table on the header page in front of it. Local
+ * consumers map both once and then read the newest records without a system call.
+ * The data region is mapped twice back to back, so a record wrapping around its end
+ * is still contiguous in userspace.
+ *
+ * @author Aamir Suhail Burhan
+ * @date 2026-10-19
+ *
+ */
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/version.h>
+#include "aesd-mmap.h"
+
+/*
+ * Brackets an update of the header, readers retry while seq is odd or has changed.
+ * Inside a batch seq already is odd and stays so until the batch ends.
+ */
+static inline void aesd_mmap_update_begin(struct aesd_mmap_view *view)
+{
+	if (view->batch++)
+		return;
+	WRITE_ONCE(view->header->seq, view->header->seq + 1);
+	smp_wmb();
+}
+
+static inline void aesd_mmap_update_end(struct aesd_mmap_view *view)
+{
+	if (--view->batch)
+		return;
+	smp_wmb();
+	WRITE_ONCE(view->header->seq, view->header->seq + 1);
+}
+
+/*
+ * Groups the appends and trims until aesd_mmap_view_batch_end() into one update, so
+ * mapped readers see the records of one write all at once or not at all.
+ * Caller must hold the device lock.
+ */
+void aesd_mmap_view_batch_begin(struct aesd_mmap_view *view)
+{
+	if (view->header)
+		aesd_mmap_update_begin(view);
+}
+
+void aesd_mmap_view_batch_end(struct aesd_mmap_view *view)
+{
+	if (view->header)
+		aesd_mmap_update_end(view);
+}
+
+/*
+ * Copies @param size bytes from @param buffptr to stream position @param start of the
+ * data region, wrapping at its end
+ */
+static void aesd_mmap_copy(struct aesd_mmap_view *view, uint64_t start, const char *buffptr, size_t size)
+{
+	size_t offset = start & (view->data_size - 1);
+	size_t first = min(size, view->data_size - offset);
+
+	memcpy(view->data + offset, buffptr, first);
+	memcpy(view->data, buffptr + first, size - first);
+}
+
+/*
+ * Adds the committed @param entry as the newest record of @param view. The oldest records
+ * go first when the entry overwrites their data, when more than @param keep records would
+ * be held or when the record table is full. An entry larger than the data region is
+ * counted but not held, which empties the view. Caller must hold the device lock.
+ */
+void aesd_mmap_view_append(struct aesd_mmap_view *view, const struct aesd_buffer_entry *entry, uint32_t keep)
+{
+	struct aesd_mmap_header *header = view->header;
+	struct aesd_mmap_record *record;
+	uint64_t head, tail;
+	uint32_t mask;
+
+	if (!header)
+		return;
+
+	head = header->head;
+	tail = header->tail;
+	mask = header->records - 1;
+	keep = min(keep, header->records);
+
+	if (entry->size > view->data_size)
+		head = tail + 1;
+
+	while ((head < tail) && (((tail - head) >= keep) ||
+			(header->record[head & mask].start + view->data_size < entry->start + entry->size)))
+		head++;
+
+	aesd_mmap_update_begin(view);
+
+	// Readers check head once they copied a record, so it moves before its data is overwritten
+	WRITE_ONCE(header->head, head);
+	smp_wmb();
+
+	if (entry->size <= view->data_size)
+	{
+		if (!view->shared)
+			aesd_mmap_copy(view, entry->start, entry->buffptr, entry->size);
+		record = &header->record[tail & mask];
+		record->start = entry->start;
+		record->size = entry->size;
+	}
+
+	smp_wmb();
+	WRITE_ONCE(header->tail, tail + 1);
+	aesd_mmap_update_end(view);
+}
+
+/*
+ * Drops the oldest records of @param view until at most @param keep are held.
+ * Caller must hold the device lock.
+ */
+void aesd_mmap_view_trim(struct aesd_mmap_view *view, uint32_t keep)
+{
+	struct aesd_mmap_header *header = view->header;
+
+	if (!header || ((header->tail - header->head) <= keep))
+		return;
+
+	aesd_mmap_update_begin(view);
+	WRITE_ONCE(header->head, header->tail - keep);
+	aesd_mmap_update_end(view);
+}
+
+/*
+ * Maps the header page followed by the data region twice into @param vma, which has to
+ * start at offset 0 and may cover only part of that. The mapping can never be written.
+ * @return 0 on success, -ENODEV when the view is disabled, -EPERM for a writable mapping,
+ * -EINVAL for one beyond the view or the error of vm_insert_page()
+ */
+int aesd_mmap_view_map(struct aesd_mmap_view *view, struct vm_area_struct *vma)
+{
+	unsigned long pages = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	unsigned long data_pages = view->data_size >> PAGE_SHIFT;
+	unsigned long i;
+	int err;
+
+	if (!view->header)
+		return -ENODEV;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if ((vma->vm_pgoff != 0) || (pages > 1 + (2 * data_pages)))
+		return -EINVAL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+#else
+	vma->vm_flags = (vma->vm_flags | VM_DONTEXPAND | VM_DONTDUMP) & ~VM_MAYWRITE;
+#endif
+
+	for (i = 0; i < pages; i++)
+	{
+		char *addr = (i == 0) ? (char *)view->header : view->data + (((i - 1) % data_pages) << PAGE_SHIFT);
+
+		err = vm_insert_page(vma, vma->vm_start + (i << PAGE_SHIFT), vmalloc_to_page(addr));
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocates a view with a data region of @param data_size bytes, rounded up to a power of
+ * two pages. A size of 0 leaves the view disabled. With @param shared_data the records
+ * already sit at their stream position in those data_size bytes, a power of two pages
+ * in vmalloc space, which the view maps instead of keeping a copy.
+ * @return 0 on success, -ENOMEM if the view could not be allocated
+ */
+int aesd_mmap_view_init(struct aesd_mmap_view *view, size_t data_size, char *shared_data)
+{
+	struct aesd_mmap_header *header;
+
+	memset(view, 0, sizeof(*view));
+	if (data_size == 0)
+		return 0;
+
+	data_size = roundup_pow_of_two(max_t(size_t, data_size, PAGE_SIZE));
+	header = vmalloc_user(shared_data ? PAGE_SIZE : PAGE_SIZE + data_size);
+	if (!header)
+		return -ENOMEM;
+
+	// A power of two table indexes with a mask, 64 bit division is not available everywhere
+	header->records = rounddown_pow_of_two((PAGE_SIZE - sizeof(*header)) / sizeof(struct aesd_mmap_record));
+	header->data_size = data_size;
+
+	view->header = header;
+	view->data = shared_data ? shared_data : (char *)header + PAGE_SIZE;
+	view->data_size = data_size;
+	view->shared = (shared_data != NULL);
+	return 0;
+}
+
+void aesd_mmap_view_exit(struct aesd_mmap_view *view)
+{
+	vfree(view->header);
+	view->header = NULL;
+}
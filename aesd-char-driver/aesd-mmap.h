@@ -0,0 +1,47 @@
+/*
+ * aesd-mmap.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: Aamir Suhail Burhan
+ *
+ *  @brief Read-only view of the newest aesdchar records which userspace can mmap
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#include <linux/types.h>
+#include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
+
+struct vm_area_struct;
+
+/**
+ * One page of struct aesd_mmap_header followed by data_size bytes, in one vmalloc_user
+ * area unless the data is shared with the byte ring. Only the writer of the device,
+ * holding its lock, updates the view.
+ */
+struct aesd_mmap_view
+{
+	struct aesd_mmap_header *header;
+	char *data;
+	size_t data_size;
+	bool shared;
+	unsigned int batch;  // Nesting depth of updates, seq is odd while it is not 0
+};
+
+extern int aesd_mmap_view_init(struct aesd_mmap_view *view, size_t data_size, char *shared_data);
+
+extern void aesd_mmap_view_exit(struct aesd_mmap_view *view);
+
+extern void aesd_mmap_view_append(struct aesd_mmap_view *view, const struct aesd_buffer_entry *entry, uint32_t keep);
+
+extern void aesd_mmap_view_trim(struct aesd_mmap_view *view, uint32_t keep);
+
+extern void aesd_mmap_view_batch_begin(struct aesd_mmap_view *view);
+
+extern void aesd_mmap_view_batch_end(struct aesd_mmap_view *view);
+
+extern int aesd_mmap_view_map(struct aesd_mmap_view *view, struct vm_area_struct *vma);
+
+#endif /* AESD_MMAP_H */
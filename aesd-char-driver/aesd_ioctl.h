@@ -33,14 +33,202 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * Occupancy of the device returned by AESDCHAR_IOCGSTATS
+ */
+struct aesd_stats {
+    /**
+     * Records currently held and the number the device can hold
+     */
+    uint32_t entries;
+    uint32_t capacity;
+    /**
+     * Bytes of the held records, and of records still waiting for their newline
+     */
+    uint64_t bytes;
+    uint64_t staged_bytes;
+    /**
+     * Largest value of bytes since the module was loaded
+     */
+    uint64_t high_water_bytes;
+    /**
+     * Byte budget of the held records, 0 when unlimited
+     */
+    uint64_t budget_bytes;
+    /**
+     * Records evicted to respect the capacity or the byte budget
+     */
+    uint64_t evictions;
+};
+
+/**
+ * One record of the mmap view. Its bytes start at data[start % data_size] and, as the data
+ * region is mapped twice back to back, are contiguous even when they wrap.
+ */
+struct aesd_mmap_record {
+    /**
+     * Stream position of the first byte, counted since the module was loaded
+     */
+    uint64_t start;
+    uint64_t size;
+};
+
+/**
+ * First page of the read-only mapping of the device, followed by the data region mapped
+ * twice. Records head to tail - 1 are held, record n in record[n % records].
+ * Readers sample seq until it is even, read head, tail and the records they want, then
+ * check seq did not change. Copied record data is intact if head has not passed the record.
+ */
+struct aesd_mmap_header {
+    /**
+     * Odd while the driver updates the view
+     */
+    uint32_t seq;
+    /**
+     * Slots in the record table
+     */
+    uint32_t records;
+    /**
+     * Bytes in the data region, a power of two and a multiple of the page size
+     */
+    uint64_t data_size;
+    /**
+     * Sequence numbers of the oldest record held and of the next record to be committed
+     */
+    uint64_t head;
+    uint64_t tail;
+    struct aesd_mmap_record record[];
+};
+
+/**
+ * Header in front of every record returned by a read in record mode, see AESDCHAR_IOCRECORDS
+ */
+struct aesd_record {
+    /**
+     * Sequence number of the record, counted since the module was loaded. A jump from one
+     * record to the next tells how many were evicted before the reader got to them.
+     */
+    uint64_t seq;
+    /**
+     * Bytes of record data following the header
+     */
+    uint64_t size;
+    /**
+     * CLOCK_MONOTONIC and CLOCK_REALTIME times the record was committed at, in ns
+     */
+    uint64_t mono_ns;
+    uint64_t real_ns;
+};
+
+/**
+ * Index of the device filled by AESDCHAR_IOCGINDEX. Records are described by a struct
+ * aesd_record each, with record data left out.
+ */
+struct aesd_index {
+    /**
+     * In: sequence number of the first record to describe. Out: the one described first,
+     * the oldest record held if the requested one was evicted
+     */
+    uint64_t first_seq;
+    /**
+     * Out: sequence numbers of the oldest record held and of the next one to be committed
+     */
+    uint64_t head_seq;
+    uint64_t tail_seq;
+    /**
+     * Out: bytes of the held records
+     */
+    uint64_t bytes;
+    /**
+     * In: user address of an array of max_records struct aesd_record
+     */
+    uint64_t records;
+    uint32_t max_records;
+    /**
+     * Out: records described in that array, oldest first
+     */
+    uint32_t nr_records;
+};
+
+/**
+ * Where AESDCHAR_IOCGRECORDS put one record in the data buffer
+ */
+struct aesd_record_slice {
+    uint64_t seq;
+    uint64_t offset;
+    uint64_t size;
+};
+
+/**
+ * Records copied by AESDCHAR_IOCGRECORDS, back to back into a user buffer, with one
+ * struct aesd_record_slice per record in a second one
+ */
+struct aesd_records_copy {
+    /**
+     * In: sequence number of the first record to copy. Out: the one copied first, the
+     * oldest record held if the requested one was evicted
+     */
+    uint64_t first_seq;
+    /**
+     * In: user address and size of the data buffer
+     */
+    uint64_t data;
+    uint64_t data_size;
+    /**
+     * In: user address of an array of max_records struct aesd_record_slice
+     */
+    uint64_t slices;
+    uint32_t max_records;
+    /**
+     * Out: records copied, as many as fit in both buffers
+     */
+    uint32_t nr_records;
+};
+
+/**
+ * Time to seek to with AESDCHAR_IOCSEEKTIME
+ */
+struct aesd_seektime {
+    /**
+     * In: time in ns on the clock below
+     */
+    uint64_t time_ns;
+    /**
+     * Out: sequence number of the record moved to, the next one to be committed if every
+     * record held is older
+     */
+    uint64_t seq;
+    /**
+     * In: CLOCK_MONOTONIC or CLOCK_REALTIME
+     */
+    uint32_t clock;
+    uint32_t reserved;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Change the number of records the device keeps, the newest records are preserved
+#define AESDCHAR_IOCRESIZE _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+// Read the occupancy, byte budget and high-water mark of the device
+#define AESDCHAR_IOCGSTATS _IOR(AESD_IOC_MAGIC, 3, struct aesd_stats)
+// Nonzero makes reads at the newest record wait for the next one, like tail -f
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 4, uint32_t)
+// Move to the record with the given sequence number, or to the oldest one held if it was evicted, and return that one's
+#define AESDCHAR_IOCSEEKSEQ _IOWR(AESD_IOC_MAGIC, 5, uint64_t)
+// Nonzero makes reads return whole records, each behind a struct aesd_record
+#define AESDCHAR_IOCRECORDS _IOW(AESD_IOC_MAGIC, 6, uint32_t)
+// Read the head and tail sequence numbers, held bytes and the size of every record in one call
+#define AESDCHAR_IOCGINDEX _IOWR(AESD_IOC_MAGIC, 7, struct aesd_index)
+// Copy a range of records and their offset table in one call
+#define AESDCHAR_IOCGRECORDS _IOWR(AESD_IOC_MAGIC, 8, struct aesd_records_copy)
+// Move to the oldest record committed at or after a monotonic or realtime time and return its sequence number
+#define AESDCHAR_IOCSEEKTIME _IOWR(AESD_IOC_MAGIC, 9, struct aesd_seektime)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 9
 
 #endif /* AESD_IOCTL_H */
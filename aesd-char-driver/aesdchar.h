@@ -8,6 +8,8 @@
 #ifndef AESD_CHAR_DRIVER_AESDCHAR_H_
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 #include "aesd-circular-buffer.h"
+#include "aesd-mmap.h"
+#include "aesd-byte-ring.h"
 #define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
 #undef PDEBUG             /* undef it, just in case */
@@ -23,18 +25,71 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+// Upper bound of the aesd_nr_devs module parameter
+#define AESDCHAR_MAX_DEVICES 64
+
+struct aesd_retired_batch;
+struct aesd_cpu_stage;
+struct aesd_merge_record;
+
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
 	struct aesd_circular_buffer buffer;	/* Buffer Entry Point	*/
-	size_t buffer_size;  // Total size of buffer when concatenated
-	struct mutex lock;
+	size_t buffer_size_hwm;  // Largest concatenated size of the buffer since load
+	uint64_t evictions;  // Entries evicted by capacity or byte budget
+	struct mutex lock;  // Serializes writers, readers only take it to fault in user pages
+	seqcount_mutex_t seq;  // Bumped around every change of buffer seen by lockless readers
+	uint32_t pending;  // Newest entries of buffer added by the write in progress, hidden from lockless readers
+	size_t pending_bytes;  // Bytes of the pending entries
+	wait_queue_head_t readq;  // Following readers waiting for the next record
+	struct aesd_retired_batch *retiring;  // Buffers evicted under lock, handed to reclaim_work when full or at the end of a write
+	struct llist_head retired;  // Batches waiting for a grace period before their buffers return to the pool
+	struct llist_head spare_batches;  // Reclaimed batches reused by the next evictions
+	struct work_struct reclaim_work;  // Frees retired batches outside the lock
+	struct aesd_cpu_stage __percpu *cpu_stage;  // Complete records staged per CPU, NULL unless aesd_merge_usecs is set
+	struct aesd_merge_record *merge;  // Records one merge took from every CPU, sorted before they are committed
+	struct hrtimer merge_timer;  // Starts merge_work aesd_merge_usecs after the first record of an empty queue
+	struct work_struct merge_work;  // Commits the staged records of every CPU
+	struct aesd_byte_ring ring;  // Storage of the records when aesd_ring_size is set, else each has a pool buffer
+	struct aesd_mmap_view view;  // Copy of the newest records for mmap, disabled unless aesd_mmap_size is set
 	struct cdev cdev;     /* Char device structure      */
-	char *temp_buffer;  // Buffer to copy temporary unappended entry
-	size_t temp_buffer_size;  // Temporary unappended buffer entry size
+	char *temp_buffer;  // Record a closed file left unterminated, continued by the next write
+	size_t temp_buffer_size;  // Bytes of that record
+	atomic64_t staged_bytes;  // Bytes of unterminated records, staged by open files or in temp_buffer
+
+};
+
+/*
+ * Where the last read of an open file stopped. The next read at the same offset
+ * continues from this entry instead of searching the ring again.
+ */
+struct aesd_read_cursor
+{
+	loff_t pos;  // File offset the cursor was left at
+	uint32_t slot;  // Entry array index holding pos
+	size_t offset;  // Byte within that entry
+};
 
+/*
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+	struct aesd_dev *dev;
+	struct aesd_read_cursor cursor;
+	bool follow;  // Reads at the newest record block for the next one, set by AESDCHAR_IOCFOLLOW
+	uint64_t follow_stream;  // Stream position a following reader continues from, kept across evictions
+	bool records;  // Reads return whole records behind a struct aesd_record, set by AESDCHAR_IOCRECORDS
+	uint64_t record_seq;  // Sequence number of the next record a read in record mode returns
+	struct mutex write_lock;  // Serializes writes of this file, staging takes no device lock
+	char *stage;  // Pool buffer of the record waiting for its newline
+	size_t stage_size;  // Bytes staged in it
+	struct aesd_buffer_entry *ready;  // Complete records of the write in progress, committed together
+	uint32_t ready_count;
+	uint32_t ready_capacity;
 };
 
 
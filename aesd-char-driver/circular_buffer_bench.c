@@ -0,0 +1,184 @@
+/**
+ * @file    circular_buffer_bench.c
+ * @brief   Lookup benchmark for the circular buffer layouts
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Userspace build of aesd-circular-buffer.c and aesd-circular-buffer-soa.c,
+ * the same sources Test_circular_buffer.c links against. Fills both layouts with the same
+ * wrapped record stream at several capacities, checks that every lookup agrees, then
+ * reports ns per find_entry_offset_for_fpos for:
+ *   aos_linear   the walk over entry sizes used before the prefix sum index
+ *   aos_binary   the binary search over entry start positions used by the driver
+ *   soa_scan     a branchless, vectorizable count over the start position array
+ *   soa_hybrid   binary search down to AESD_SOA_SCAN_WINDOW entries, then the count
+ * Build with "make bench", run as ./circular_buffer_bench [lookups].
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "aesd-circular-buffer.h"
+#include "aesd-circular-buffer-soa.h"
+
+#define DEFAULT_LOOKUPS (2000000)
+#define MAX_RECORD_SIZE (200)
+
+static const uint32_t bench_capacities[] = { 10, 64, 256, 1024, 16384, 262144 };
+
+
+/* Description: Returns the monotonic clock in seconds
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Description: Linear walk from the oldest entry summing sizes, as the driver did
+ * before entries carried their start position
+ */
+static struct aesd_buffer_entry *aos_linear_find(struct aesd_circular_buffer *buffer,
+        size_t char_offset, size_t *entry_offset_byte_rtn)
+{
+    uint32_t remaining = aesd_circular_buffer_count(buffer);
+    uint32_t index = buffer->out_offs;
+    size_t bytes_read = 0;
+
+    while (remaining-- > 0)
+    {
+        size_t entry_size = buffer->entry[index].size;
+
+        if (bytes_read + entry_size > char_offset)
+        {
+            *entry_offset_byte_rtn = char_offset - bytes_read;
+            return &buffer->entry[index];
+        }
+        bytes_read += entry_size;
+        index = aesd_circular_buffer_next(buffer, index);
+    }
+    return NULL;
+}
+
+/* Description: Each lookup result is folded into a sink so the compiler cannot drop it
+ */
+static double bench_aos(struct aesd_buffer_entry *(*find)(struct aesd_circular_buffer *, size_t, size_t *),
+        struct aesd_circular_buffer *buffer, const size_t *offsets, size_t lookups, size_t *sink)
+{
+    double start = now_seconds();
+    size_t i, offset;
+
+    for (i = 0; i < lookups; i++)
+        *sink += (size_t) find(buffer, offsets[i], &offset) + offset;
+
+    return (now_seconds() - start) * 1e9 / lookups;
+}
+
+static double bench_soa(long (*find)(const struct aesd_circular_buffer_soa *, size_t, size_t *),
+        const struct aesd_circular_buffer_soa *buffer, const size_t *offsets, size_t lookups, size_t *sink)
+{
+    double start = now_seconds();
+    size_t i, offset;
+
+    for (i = 0; i < lookups; i++)
+        *sink += (size_t) find(buffer, offsets[i], &offset) + offset;
+
+    return (now_seconds() - start) * 1e9 / lookups;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t lookups = (argc > 1) ? (size_t) atol(argv[1]) : DEFAULT_LOOKUPS;
+    size_t *offsets = malloc(lookups * sizeof(size_t));
+    static char record[MAX_RECORD_SIZE];
+    size_t sink = 0;
+    size_t c;
+
+    if ((offsets == NULL) || (lookups == 0))
+    {
+        perror("Malloc for lookup offsets");
+        return 1;
+    }
+
+    printf("%10s %12s %12s %12s %12s  (ns per lookup)\n", "capacity", "aos_linear", "aos_binary", "soa_scan", "soa_hybrid");
+
+    for (c = 0; c < sizeof(bench_capacities) / sizeof(bench_capacities[0]); c++)
+    {
+        uint32_t capacity = bench_capacities[c];
+        struct aesd_circular_buffer aos;
+        struct aesd_circular_buffer_soa soa;
+        struct aesd_buffer_entry *entries = malloc(capacity * sizeof(struct aesd_buffer_entry));
+        uint64_t *start = malloc(capacity * sizeof(uint64_t));
+        size_t *size = malloc(capacity * sizeof(size_t));
+        const char **buffptr = malloc(capacity * sizeof(const char *));
+        size_t total, i, linear_lookups;
+        double aos_linear, aos_binary, soa_scan, soa_hybrid;
+
+        if ((entries == NULL) || (start == NULL) || (size == NULL) || (buffptr == NULL))
+        {
+            perror("Malloc for benchmark buffers");
+            return 1;
+        }
+
+        aesd_circular_buffer_init_capacity(&aos, entries, capacity);
+        aesd_circular_buffer_soa_init(&soa, start, size, buffptr, capacity);
+
+        // Add one and a half times the capacity so both layouts have wrapped
+        srand(capacity);
+        for (i = 0; i < capacity + (capacity / 2); i++)
+        {
+            struct aesd_buffer_entry entry = { .buffptr = record, .size = 1 + (rand() % MAX_RECORD_SIZE) };
+
+            aesd_circular_buffer_add_entry(&aos, &entry);
+            aesd_circular_buffer_soa_add_entry(&soa, entry.buffptr, entry.size);
+        }
+
+        total = aesd_circular_buffer_size(&aos);
+        for (i = 0; i < lookups; i++)
+            offsets[i] = ((size_t) rand() * RAND_MAX + rand()) % total;
+
+        // Correctness first, benchmarks of a wrong implementation are worthless
+        for (i = 0; i < 100000; i++)
+        {
+            size_t offset = (i < total) ? i : offsets[i % lookups];
+            size_t linear_byte, binary_byte, scan_byte, hybrid_byte;
+            struct aesd_buffer_entry *linear = aos_linear_find(&aos, offset, &linear_byte);
+            struct aesd_buffer_entry *binary = aesd_circular_buffer_find_entry_offset_for_fpos(&aos, offset, &binary_byte);
+            long scan = aesd_circular_buffer_soa_scan_entry_offset_for_fpos(&soa, offset, &scan_byte);
+            long hybrid = aesd_circular_buffer_soa_find_entry_offset_for_fpos(&soa, offset, &hybrid_byte);
+
+            if ((linear == NULL) || (linear != binary) || (linear_byte != binary_byte) ||
+                ((linear - entries) != scan) || (scan != hybrid) || (scan_byte != linear_byte) ||
+                (hybrid_byte != linear_byte))
+            {
+                fprintf(stderr, "Lookup mismatch at capacity %u offset %zu\n", capacity, offset);
+                return 1;
+            }
+        }
+
+        // The linear walk is O(n), keep its run time bounded on large rings
+        linear_lookups = (lookups * 64) / capacity;
+        linear_lookups = (linear_lookups < lookups) ? linear_lookups : lookups;
+        linear_lookups = linear_lookups ? linear_lookups : 1;
+
+        aos_linear = bench_aos(aos_linear_find, &aos, offsets, linear_lookups, &sink);
+        aos_binary = bench_aos(aesd_circular_buffer_find_entry_offset_for_fpos, &aos, offsets, lookups, &sink);
+        soa_scan = bench_soa(aesd_circular_buffer_soa_scan_entry_offset_for_fpos, &soa, offsets, linear_lookups, &sink);
+        soa_hybrid = bench_soa(aesd_circular_buffer_soa_find_entry_offset_for_fpos, &soa, offsets, lookups, &sink);
+
+        printf("%10u %12.1f %12.1f %12.1f %12.1f\n", capacity, aos_linear, aos_binary, soa_scan, soa_hybrid);
+
+        free(entries);
+        free(start);
+        free(size);
+        free(buffptr);
+    }
+
+    // Printing the sink keeps every lookup observable
+    fprintf(stderr, "sink %zu\n", sink);
+    free(offsets);
+    return 0;
+}
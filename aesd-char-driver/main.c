@@ -18,16 +18,61 @@
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
 #include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/splice.h>
+#include <linux/version.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/sort.h>
+#include <linux/hrtimer.h>
 #include "aesdchar.h"
 #include "aesd-circular-buffer.h"
 #include "aesd_ioctl.h"
+#include "aesd-buffer-pool.h"
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+// Number of devices, minors aesd_minor to aesd_minor + aesd_nr_devs - 1, each with its own records and lock
+static unsigned int aesd_nr_devs = 1;
+module_param(aesd_nr_devs, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of aesdchar devices (default 1)");
+
+// Number of records the device keeps, power of two values wrap with a mask
+static unsigned int aesd_capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(aesd_capacity, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_capacity, "Number of records kept by each device (default 10)");
+
+// Total bytes of committed records the device keeps, read on every commit so it can change at runtime
+static unsigned long aesd_budget = 0;
+module_param(aesd_budget, ulong, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(aesd_budget, "Byte budget of the records kept by each device, 0 for no limit (default 0)");
+
+// Bytes of record data in the mmap view, 0 disables mmap and the copy made on every commit
+static unsigned long aesd_mmap_size = 0;
+module_param(aesd_mmap_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(aesd_mmap_size, "Bytes of the read-only mmap view of the newest records, 0 to disable (default 0)");
+
+// Bytes of the preallocated ring records are packed into, 0 keeps one pool buffer per record
+static unsigned long aesd_ring_size = 0;
+module_param(aesd_ring_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(aesd_ring_size, "Bytes of the byte ring storing the records, 0 for a buffer per record (default 0)");
+
+// Microseconds a record staged per CPU may wait for the merge which commits it, 0 commits every write directly
+static unsigned int aesd_merge_usecs = 0;
+module_param(aesd_merge_usecs, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_merge_usecs, "Latency bound of records staged per CPU and merged in batches, 0 to commit every write directly (default 0)");
+
 MODULE_AUTHOR("Aamir Suhail Burhan"); /** TODO: fill in your name **/
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices;  // Array of aesd_nr_devs devices
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
@@ -36,271 +81,1735 @@ int aesd_open(struct inode *inode, struct file *filp)
 	 * TODO: handle open
 	 */
 	struct aesd_dev *dev= container_of(inode->i_cdev, struct aesd_dev, cdev);
-	filp->private_data = dev;
+	struct aesd_file *file = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+
+	if (!file)
+		return -ENOMEM;
+	file->dev = dev;
+	mutex_init(&file->write_lock);
+	filp->private_data = file;
 	PDEBUG("open end");
 
 	return 0;
 }
 
+/*
+ * Hands the record @param file left unterminated to its device, the next write of any
+ * file continues it. One already waiting there is continued by this one. With a byte
+ * ring a join which no longer fits in the ring is dropped, as its write would be.
+ */
+static void aesd_carry_record(struct aesd_file *file)
+{
+	struct aesd_dev *dev = file->dev;
+	char *joined;
+
+	mutex_lock(&dev->lock);
+	if (!dev->temp_buffer_size)
+	{
+		dev->temp_buffer = file->stage;
+		dev->temp_buffer_size = file->stage_size;
+	}
+	else if (dev->ring.data && (dev->temp_buffer_size + file->stage_size >= dev->ring.size))
+	{
+		atomic64_add(-(long long)(dev->temp_buffer_size + file->stage_size), &dev->staged_bytes);
+		aesd_pool_free(dev->temp_buffer, dev->temp_buffer_size);
+		aesd_pool_free(file->stage, file->stage_size);
+		dev->temp_buffer = NULL;
+		dev->temp_buffer_size = 0;
+	}
+	else
+	{
+		// Without memory to join them the bytes of this file are dropped
+		joined = aesd_pool_alloc(dev->temp_buffer_size + file->stage_size);
+		if (joined)
+		{
+			memcpy(joined, dev->temp_buffer, dev->temp_buffer_size);
+			memcpy(joined + dev->temp_buffer_size, file->stage, file->stage_size);
+			aesd_pool_free(dev->temp_buffer, dev->temp_buffer_size);
+			dev->temp_buffer = joined;
+			dev->temp_buffer_size += file->stage_size;
+		}
+		else
+		{
+			atomic64_add(-(long long)file->stage_size, &dev->staged_bytes);
+		}
+		aesd_pool_free(file->stage, file->stage_size);
+	}
+	mutex_unlock(&dev->lock);
+}
+
 int aesd_release(struct inode *inode, struct file *filp)
 {
 	PDEBUG("release");
-	/**
-	 * TODO: handle release
-	 */
+	struct aesd_file *file = filp->private_data;
+
+	// Like a device wide staging buffer, a record left without its newline is continued by the next write
+	if (file->stage_size)
+		aesd_carry_record(file);
+
+	kfree(file->ready);
+	mutex_destroy(&file->write_lock);
+	kfree(file);
+	return 0;
+}
+
+/*
+ * Copies the metadata of the circular buffer of @param dev into @param snapshot, which then
+ * indexes the live entry array, without the entries of a write still in progress.
+ * Call inside a read section of dev->seq and under rcu_read_lock(), entry arrays and
+ * evicted buffers are only freed after a grace period.
+ */
+static inline void aesd_buffer_snapshot(struct aesd_dev *dev, struct aesd_circular_buffer *snapshot)
+{
+	snapshot->entry = dev->buffer.entry;
+	snapshot->capacity = dev->buffer.capacity;
+	snapshot->mask = dev->buffer.mask;
+	snapshot->in_offs = dev->buffer.in_offs;
+	snapshot->out_offs = dev->buffer.out_offs;
+	snapshot->full = dev->buffer.full;
+	snapshot->base = dev->buffer.base;
+	snapshot->base_seq = dev->buffer.base_seq;
+	snapshot->tail = dev->buffer.tail - dev->pending_bytes;
+
+	if (dev->pending)
+	{
+		snapshot->in_offs = aesd_circular_buffer_advance(snapshot, snapshot->in_offs,
+				snapshot->capacity - dev->pending);
+		snapshot->full = false;
+	}
+}
+
+/*
+ * @return the stream position after the newest entry readers may see. Call inside a read
+ * section of dev->seq.
+ */
+static inline uint64_t aesd_published_tail(struct aesd_dev *dev)
+{
+	return dev->buffer.tail - dev->pending_bytes;
+}
+
+/*
+ * @return the sequence number of the next record readers will see. Call inside a read
+ * section of dev->seq.
+ */
+static inline uint64_t aesd_published_next_seq(struct aesd_dev *dev)
+{
+	return aesd_circular_buffer_next_seq(&dev->buffer) - dev->pending;
+}
+
+/*
+ * @return aesd_published_tail() of @param dev, read without the lock
+ */
+static uint64_t aesd_read_published_tail(struct aesd_dev *dev)
+{
+	unsigned int seq;
+	uint64_t tail;
+
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		tail = aesd_published_tail(dev);
+	} while (read_seqcount_retry(&dev->seq, seq));
+
+	return tail;
+}
+
+/*
+ * @return aesd_published_next_seq() of @param dev, read without the lock
+ */
+static uint64_t aesd_read_published_next_seq(struct aesd_dev *dev)
+{
+	unsigned int seq;
+	uint64_t next_seq;
+
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		next_seq = aesd_published_next_seq(dev);
+	} while (read_seqcount_retry(&dev->seq, seq));
+
+	return next_seq;
+}
+
+/*
+ * @return true if the read cursor of @param file still locates file offset @param pos in
+ * @param buffer. The cursor is only a hint, racing readers of one file may leave any
+ * mix of fields behind, so the entry it names has to start where pos says it does.
+ */
+static bool aesd_cursor_valid(const struct aesd_file *file, const struct aesd_circular_buffer *buffer, loff_t pos)
+{
+	struct aesd_read_cursor cursor = file->cursor;
+	const struct aesd_buffer_entry *entry;
+	uint64_t start;
+
+	if ((cursor.pos != pos) || (cursor.slot >= buffer->capacity) || (cursor.offset > pos))
+		return false;
+
+	entry = &buffer->entry[cursor.slot];
+	start = buffer->base + pos - cursor.offset;
+	return (start < buffer->tail) && (READ_ONCE(entry->start) == start) &&
+		(cursor.offset < READ_ONCE(entry->size));
+}
+
+/*
+ * Copies the entries of @param buffer from file offset @param pos into @param to, crossing
+ * entry boundaries until @param to is full or the newest entry has been copied.
+ * Lockless callers pass a snapshot and @param atomic, the copy then stops at the first user
+ * page which is not present and at the first entry which may have been evicted meanwhile.
+ * @return the number of bytes copied, the read cursor of @param file is left after them
+ */
+static size_t aesd_copy_entries(struct aesd_file *file, const struct aesd_circular_buffer *buffer,
+		loff_t pos, struct iov_iter *to, bool atomic)
+{
+	struct aesd_dev *dev = file->dev;
+	uint64_t position = buffer->base + pos;
+	size_t copied = 0;
+	uint32_t slot;
+	size_t offset;
+
+	if (aesd_cursor_valid(file, buffer, pos))
+	{
+		slot = file->cursor.slot;
+		offset = file->cursor.offset;
+	}
+	else
+	{
+		struct aesd_buffer_entry *entry = aesd_circular_buffer_find_entry_offset_for_fpos(
+				(struct aesd_circular_buffer *)buffer, pos, &offset);
+
+		if (!entry)
+			return 0;
+		slot = entry - buffer->entry;
+	}
+
+	while (iov_iter_count(to) && (position < buffer->tail))
+	{
+		const struct aesd_buffer_entry *entry = &buffer->entry[slot];
+		const char *buffptr = READ_ONCE(entry->buffptr);
+		size_t size = READ_ONCE(entry->size);
+		size_t chunk, done;
+
+		if (atomic)
+		{
+			// A slot is only reused after its entry was evicted, and eviction moves base first
+			smp_rmb();
+			if ((READ_ONCE(entry->start) != position - offset) || (READ_ONCE(dev->buffer.base) > position - offset))
+				break;
+
+			chunk = min(size - offset, iov_iter_count(to));
+			pagefault_disable();
+			done = copy_to_iter(buffptr + offset, chunk, to);
+			pagefault_enable();
+
+			// The byte ring reuses the space of an evicted entry at once, what was copied may be torn
+			smp_rmb();
+			if (READ_ONCE(dev->buffer.base) > position - offset)
+			{
+				iov_iter_revert(to, done);
+				break;
+			}
+		}
+		else
+		{
+			chunk = min(size - offset, iov_iter_count(to));
+			done = copy_to_iter(buffptr + offset, chunk, to);
+		}
+
+		copied += done;
+		position += done;
+		offset += done;
+		if (done < chunk)
+			break;
+		if (offset == size)
+		{
+			slot = aesd_circular_buffer_next(buffer, slot);
+			offset = 0;
+		}
+	}
+
+	file->cursor.pos = pos + copied;
+	file->cursor.slot = slot;
+	file->cursor.offset = offset;
+	return copied;
+}
+
+/*
+ * @return the stream position a read of @param file at file offset @param pos starts from.
+ * Following readers continue where their last read stopped even when the oldest entries
+ * were evicted meanwhile, other file offsets count from the oldest entry at @param base.
+ */
+static inline uint64_t aesd_read_position(const struct aesd_file *file, loff_t pos, uint64_t base)
+{
+	return file->follow ? file->follow_stream : base + pos;
+}
+
+/*
+ * Moves the file offset of @param iocb past the @param copied bytes read from stream
+ * @param position, @param base being the oldest entry of the ring they were read from.
+ * @return copied
+ */
+static ssize_t aesd_read_done(struct aesd_file *file, struct kiocb *iocb, uint64_t position,
+		size_t copied, uint64_t base)
+{
+	iocb->ki_pos = position - base + copied;
+	if (file->follow)
+		file->follow_stream = position + copied;
+	return copied;
+}
+
+/*
+ * Copies the records of @param buffer from sequence number @param record_seq on into
+ * @param to, each behind its struct aesd_record, until the next one does not fit or the
+ * newest one has been copied. Lockless callers pass a snapshot and @param atomic, the copy
+ * then stops at the first user page which is not present and at the first record which
+ * may have been evicted meanwhile.
+ * @return the number of bytes copied, record_seq is left at the record following them
+ */
+static size_t aesd_copy_records(struct aesd_dev *dev, const struct aesd_circular_buffer *buffer,
+		uint64_t *record_seq, struct iov_iter *to, bool atomic)
+{
+	size_t copied = 0;
+
+	while (*record_seq < aesd_circular_buffer_next_seq(buffer))
+	{
+		const struct aesd_buffer_entry *entry = aesd_circular_buffer_entry_at(
+				(struct aesd_circular_buffer *)buffer, *record_seq - buffer->base_seq, NULL);
+		const char *buffptr = READ_ONCE(entry->buffptr);
+		struct aesd_record header;
+		size_t done;
+
+		header.seq = *record_seq;
+		header.size = READ_ONCE(entry->size);
+		header.mono_ns = READ_ONCE(entry->mono_ns);
+		header.real_ns = READ_ONCE(entry->real_ns);
+		if (sizeof(header) + header.size > iov_iter_count(to))
+			break;
+
+		if (atomic)
+		{
+			// A slot is only reused after its record was evicted, and eviction moves base_seq first
+			smp_rmb();
+			if (READ_ONCE(dev->buffer.base_seq) > *record_seq)
+				break;
+
+			pagefault_disable();
+			done = copy_to_iter(&header, sizeof(header), to);
+			done += copy_to_iter(buffptr, header.size, to);
+			pagefault_enable();
+
+			smp_rmb();
+			if ((done < sizeof(header) + header.size) || (READ_ONCE(dev->buffer.base_seq) > *record_seq))
+			{
+				iov_iter_revert(to, done);
+				break;
+			}
+		}
+		else
+		{
+			done = copy_to_iter(&header, sizeof(header), to);
+			done += copy_to_iter(buffptr, header.size, to);
+			if (done < sizeof(header) + header.size)
+			{
+				iov_iter_revert(to, done);
+				break;
+			}
+		}
+
+		copied += done;
+		(*record_seq)++;
+	}
+
+	return copied;
+}
+
+/*
+ * Read in record mode: whole records from file->record_seq on, records evicted before the
+ * reader got to them are skipped and show as a gap in the sequence numbers.
+ * @return the bytes copied, -EMSGSIZE when the next record does not fit in @param to
+ */
+static ssize_t aesd_read_records(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	uint64_t record_seq;
+	size_t copied;
+	bool held, fits;
+	unsigned int seq;
+
+	while (1)
+	{
+		rcu_read_lock();
+		do
+		{
+			seq = read_seqcount_begin(&dev->seq);
+			aesd_buffer_snapshot(dev, &snapshot);
+		} while (read_seqcount_retry(&dev->seq, seq));
+
+		record_seq = max(file->record_seq, snapshot.base_seq);
+		copied = aesd_copy_records(dev, &snapshot, &record_seq, to, true);
+		rcu_read_unlock();
+
+		if (copied)
+		{
+			file->record_seq = record_seq;
+			return copied;
+		}
+
+		if (record_seq < aesd_circular_buffer_next_seq(&snapshot))
+			break;
+
+		// At the newest record only following readers wait for the next one
+		if (!file->follow)
+			return 0;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->readq, aesd_read_published_next_seq(dev) > record_seq))
+			return -ERESTARTSYS;
+	}
+
+	// The next record does not fit or its user page has to be faulted in, find out holding the lock
+	if(mutex_lock_interruptible(&dev->lock) != 0)
+	{
+		PDEBUG("Error in read mutex locking");
+		return -ERESTARTSYS;
+	}
+
+	record_seq = max(file->record_seq, dev->buffer.base_seq);
+	held = (record_seq < aesd_circular_buffer_next_seq(&dev->buffer));
+	fits = !held || (sizeof(struct aesd_record) + aesd_circular_buffer_entry_at(&dev->buffer,
+			record_seq - dev->buffer.base_seq, NULL)->size <= iov_iter_count(to));
+	copied = aesd_copy_records(dev, &dev->buffer, &record_seq, to, false);
+
+	// Unlock the mutex
+	mutex_unlock(&dev->lock);
+
+	if (copied)
+	{
+		file->record_seq = record_seq;
+		return copied;
+	}
+	if (!held)
+		return 0;
+	return fits ? -EFAULT : -EMSGSIZE;
+}
+
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	uint64_t position;
+	size_t copied;
+	unsigned int seq;
+
+	PDEBUG("read %zu bytes with offset %lld", iov_iter_count(to), iocb->ki_pos);
+
+	if (file->records)
+		return aesd_read_records(iocb, to);
+
+	while (1)
+	{
+		// Lockless path: fill the whole request from a consistent snapshot of the ring under RCU
+		rcu_read_lock();
+		do
+		{
+			seq = read_seqcount_begin(&dev->seq);
+			aesd_buffer_snapshot(dev, &snapshot);
+		} while (read_seqcount_retry(&dev->seq, seq));
+
+		position = aesd_read_position(file, iocb->ki_pos, snapshot.base);
+		copied = 0;
+		if (position >= snapshot.base)
+			copied = aesd_copy_entries(file, &snapshot, position - snapshot.base, to, true);
+		rcu_read_unlock();
+
+		// A following reader overtaken by eviction learns about the lost records once, then restarts at the oldest one
+		if (position < snapshot.base)
+		{
+			file->follow_stream = snapshot.base;
+			return -EPIPE;
+		}
+
+		if (copied || !iov_iter_count(to))
+			return aesd_read_done(file, iocb, position, copied, snapshot.base);
+
+		if (position < snapshot.tail)
+			break;
+
+		// At the newest record only following readers wait for the next one
+		if (!file->follow)
+			return 0;
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(dev->readq, aesd_read_published_tail(dev) > position))
+			return -ERESTARTSYS;
+	}
+
+	// Faulting the user page in may sleep, retry holding the lock which keeps entries from being evicted
+	if(mutex_lock_interruptible(&dev->lock) != 0)
+	{
+		PDEBUG("Error in read mutex locking");
+		return -ERESTARTSYS;
+	}
+
+	snapshot.base = dev->buffer.base;
+	snapshot.tail = dev->buffer.tail;
+	position = aesd_read_position(file, iocb->ki_pos, snapshot.base);
+	copied = 0;
+	if (position >= snapshot.base)
+		copied = aesd_copy_entries(file, &dev->buffer, position - snapshot.base, to, false);
+
+	// Unlock the mutex
+	mutex_unlock(&dev->lock);
+
+	if (position < snapshot.base)
+	{
+		file->follow_stream = snapshot.base;
+		return -EPIPE;
+	}
+
+	if (!copied && (position < snapshot.tail))
+		return -EFAULT;
+
+	return aesd_read_done(file, iocb, position, copied, snapshot.base);
+}
+
+/*
+ * Description: Kernel poll implementation
+ * Readable while there is data past the file offset, or a record past the sequence number
+ * in record mode. Following readers overtaken by eviction get EPOLLERR | EPOLLPRI.
+ * Writes never wait for buffer space.
+ */
+__poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+	uint64_t base, tail, position, next_seq;
+	unsigned int seq;
+
+	poll_wait(filp, &dev->readq, wait);
+
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		base = dev->buffer.base;
+		tail = aesd_published_tail(dev);
+		next_seq = aesd_published_next_seq(dev);
+	} while (read_seqcount_retry(&dev->seq, seq));
+
+	// Record mode skips evicted records instead of reporting them
+	if (file->records)
+		return (file->record_seq < next_seq) ? (mask | EPOLLIN | EPOLLRDNORM) : mask;
+
+	position = aesd_read_position(file, filp->f_pos, base);
+	if (position < base)
+		mask |= EPOLLERR | EPOLLPRI;
+	else if (position < tail)
+		mask |= EPOLLIN | EPOLLRDNORM;
+
+	return mask;
+}
+
+/*
+ * Buffers of evicted entries, returned to the pool by the reclaim work once every RCU
+ * reader which may still copy from them has finished. Reclaimed batches are reused.
+ */
+#define AESD_RETIRE_BATCH 64
+
+struct aesd_retired_batch
+{
+	struct llist_node node;
+	uint32_t count;
+	struct aesd_buffer_entry entries[AESD_RETIRE_BATCH];
+};
+
+/*
+ * @return the batch collecting the evictions of @param dev, taken from the reclaimed ones
+ * or allocated without sleeping, NULL if there is none. Caller must hold dev->lock.
+ */
+static struct aesd_retired_batch *aesd_retiring_batch(struct aesd_dev *dev)
+{
+	struct llist_node *spare;
+
+	if (dev->retiring)
+		return dev->retiring;
+
+	spare = llist_del_first(&dev->spare_batches);
+	if (spare)
+		dev->retiring = llist_entry(spare, struct aesd_retired_batch, node);
+	else
+		dev->retiring = kmalloc(sizeof(struct aesd_retired_batch), GFP_NOWAIT | __GFP_NOWARN);
+
+	if (dev->retiring)
+		dev->retiring->count = 0;
+	return dev->retiring;
+}
+
+/*
+ * Hands the evictions collected by @param dev to the reclaim work.
+ * Caller must hold dev->lock.
+ */
+static void aesd_retire_flush(struct aesd_dev *dev)
+{
+	if (!dev->retiring || !dev->retiring->count)
+		return;
+
+	llist_add(&dev->retiring->node, &dev->retired);
+	dev->retiring = NULL;
+	schedule_work(&dev->reclaim_work);
+}
+
+/*
+ * Makes sure a write of @param dev finds a batch for its evictions without allocating
+ * under dev->lock. Called without it.
+ */
+static void aesd_reserve_batch(struct aesd_dev *dev)
+{
+	struct aesd_retired_batch *batch;
+
+	if (dev->ring.data || !llist_empty(&dev->spare_batches))
+		return;
+
+	batch = kmalloc(sizeof(struct aesd_retired_batch), GFP_KERNEL);
+	if (batch)
+		llist_add(&batch->node, &dev->spare_batches);
+}
+
+/*
+ * Returns the buffers of every retired batch to the pool after one RCU grace period,
+ * then keeps the batches for reuse. Runs from the system workqueue, outside dev->lock.
+ */
+static void aesd_reclaim_work(struct work_struct *work)
+{
+	struct aesd_dev *dev = container_of(work, struct aesd_dev, reclaim_work);
+	struct llist_node *retired = llist_del_all(&dev->retired);
+	struct aesd_retired_batch *batch, *next;
+	uint32_t i;
+
+	if (!retired)
+		return;
+
+	// Every entry was removed before its batch was queued, one grace period covers them all
+	synchronize_rcu();
+
+	llist_for_each_entry_safe(batch, next, retired, node)
+	{
+		for (i = 0; i < batch->count; i++)
+			aesd_pool_free(batch->entries[i].buffptr, batch->entries[i].size);
+		batch->count = 0;
+		llist_add(&batch->node, &dev->spare_batches);
+	}
+}
+
+/*
+ * Keeps the pending entries of @param dev within those it still holds once a write
+ * evicted some of its own records. Caller must be in a write section of dev->seq.
+ */
+static inline void aesd_clamp_pending(struct aesd_dev *dev)
+{
+	if (dev->pending > aesd_circular_buffer_count(&dev->buffer))
+	{
+		dev->pending = aesd_circular_buffer_count(&dev->buffer);
+		dev->pending_bytes = aesd_circular_buffer_size(&dev->buffer);
+	}
+}
+
+/*
+ * Evicts the @param count oldest entries of @param dev in write sections of dev->seq, one
+ * per batch of AESD_RETIRE_BATCH. Their buffers are collected in dev->retiring for the
+ * reclaim work, byte ring space is free at once. Caller must hold dev->lock.
+ */
+static void aesd_evict_oldest(struct aesd_dev *dev, uint32_t count)
+{
+	struct aesd_retired_batch *batch;
+	struct aesd_buffer_entry oldest_entry;
+	uint32_t evicted = 0;
+	bool removed;
+
+	if (dev->ring.data)
+	{
+		// Byte ring space is reused right away, lockless readers drop bytes copied from evicted entries
+		write_seqcount_begin(&dev->seq);
+		while ((evicted < count) && aesd_circular_buffer_remove_entry(&dev->buffer, &oldest_entry))
+			evicted++;
+		aesd_clamp_pending(dev);
+		write_seqcount_end(&dev->seq);
+
+		dev->evictions += evicted;
+		aesd_mmap_view_trim(&dev->view, aesd_circular_buffer_count(&dev->buffer));
+		return;
+	}
+
+	while (evicted < count)
+	{
+		batch = aesd_retiring_batch(dev);
+		if (!batch)
+		{
+			// Without a batch wait for the readers after every eviction, only when memory is short
+			write_seqcount_begin(&dev->seq);
+			removed = aesd_circular_buffer_remove_entry(&dev->buffer, &oldest_entry);
+			aesd_clamp_pending(dev);
+			write_seqcount_end(&dev->seq);
+			if (!removed)
+				break;
+
+			synchronize_rcu();
+			aesd_pool_free(oldest_entry.buffptr, oldest_entry.size);
+			evicted++;
+			continue;
+		}
+
+		write_seqcount_begin(&dev->seq);
+		while ((evicted < count) && (batch->count < AESD_RETIRE_BATCH) &&
+				aesd_circular_buffer_remove_entry(&dev->buffer, &batch->entries[batch->count]))
+		{
+			batch->count++;
+			evicted++;
+		}
+		aesd_clamp_pending(dev);
+		write_seqcount_end(&dev->seq);
+
+		if (batch->count < AESD_RETIRE_BATCH)
+			break;
+		aesd_retire_flush(dev);
+	}
+
+	dev->evictions += evicted;
+}
+
+/*
+ * Evicts the oldest entries of @param dev until @param staged bytes fit in the byte ring
+ * after the newest entry. Caller must hold dev->lock.
+ */
+static void aesd_ring_reserve(struct aesd_dev *dev, size_t staged)
+{
+	uint32_t held = aesd_circular_buffer_count(&dev->buffer);
+	size_t held_bytes = aesd_circular_buffer_size(&dev->buffer);
+	uint32_t evict = 0;
+
+	while ((evict < held) && (held_bytes + staged > dev->ring.size))
+	{
+		held_bytes -= aesd_circular_buffer_entry_at(&dev->buffer, evict, NULL)->size;
+		evict++;
+	}
+	if (evict)
+		aesd_evict_oldest(dev, evict);
+}
+
+/*
+ * Commits the complete @param record of @param dev as the newest entry of the circular buffer.
+ * The oldest entries are evicted while the buffer is full or the record would not fit
+ * in aesd_budget, a record larger than the whole budget is kept on its own.
+ * The entry takes ownership of the pool buffer of the record, or with a byte ring the
+ * record is copied right after the newest entry and its buffer freed. The entry keeps the
+ * commit times of the record. It stays pending until aesd_publish_records().
+ * Caller must hold dev->lock.
+ */
+static void aesd_commit_record(struct aesd_dev *dev, const struct aesd_buffer_entry *record)
+{
+	struct aesd_buffer_entry add_entry;
+	unsigned long budget = READ_ONCE(aesd_budget);
+	uint32_t held = aesd_circular_buffer_count(&dev->buffer);
+	size_t held_bytes = aesd_circular_buffer_size(&dev->buffer);
+	uint32_t evict = 0;
+
+	add_entry.size = record->size;
+	add_entry.buffptr = record->buffptr;
+	add_entry.mono_ns = record->mono_ns;
+	add_entry.real_ns = record->real_ns;
+
+	// Count the oldest entries which have to go, then evict them together
+	while ((evict < held) && (((held - evict) >= dev->buffer.capacity) ||
+			(budget && (held_bytes + add_entry.size > budget))))
+	{
+		held_bytes -= aesd_circular_buffer_entry_at(&dev->buffer, evict, NULL)->size;
+		evict++;
+	}
+	if (evict)
+		aesd_evict_oldest(dev, evict);
+
+	if (dev->ring.data)
+	{
+		// Entries always point into the first mapping of the ring
+		aesd_ring_reserve(dev, add_entry.size);
+		add_entry.buffptr = aesd_byte_ring_at(&dev->ring, dev->buffer.tail);
+		memcpy((char *)add_entry.buffptr, record->buffptr, add_entry.size);
+		aesd_pool_free(record->buffptr, add_entry.size);
+	}
+
+	// The new entry stays pending, hidden from lockless readers until the write publishes it
+	write_seqcount_begin(&dev->seq);
+	aesd_circular_buffer_add_entry(&dev->buffer, &add_entry);
+	dev->pending++;
+	dev->pending_bytes += add_entry.size;
+	write_seqcount_end(&dev->seq);
+
+	held = aesd_circular_buffer_count(&dev->buffer);
+	aesd_mmap_view_append(&dev->view, aesd_circular_buffer_entry_at(&dev->buffer, held - 1, NULL), held);
+
+	dev->buffer_size_hwm = max(dev->buffer_size_hwm, aesd_circular_buffer_size(&dev->buffer));
+}
+
+/*
+ * Most bytes one pass of aesd_stage_write() copies, the largest pool class. A record
+ * longer than that takes passes of its own size, so it is moved O(log size) times.
+ */
+#define AESD_STAGE_CHUNK (1UL << AESD_POOL_MAX_SHIFT)
+
+/*
+ * Copies the next chunk of user data in @param from, at most @param remaining bytes, in
+ * one pass after the bytes staged by @param file. They go straight into the staging buffer
+ * when its size class has room, else into a new buffer sized for the staged bytes and the
+ * whole chunk, which the staged bytes are moved to. The file is left to the caller.
+ * Caller must hold file->write_lock.
+ * @return the number of bytes copied into *@param staging, fewer when user memory faults
+ * part way, -ENOMEM or -EFAULT when nothing was
+ */
+static ssize_t aesd_stage_chunk(struct aesd_file *file, struct iov_iter *from, size_t remaining,
+		char **staging)
+{
+	size_t used = file->stage_size;
+	char *buffer = file->stage;
+	size_t copied;
+
+	if (used + remaining > aesd_pool_capacity(used))
+	{
+		buffer = aesd_pool_alloc(used + remaining);
+		if (!buffer)
+			return -ENOMEM;
+	}
+
+	copied = copy_from_iter(buffer + used, remaining, from);
+	if (!copied)
+	{
+		if (buffer != file->stage)
+			aesd_pool_free(buffer, used + remaining);
+		return -EFAULT;
+	}
+
+	if ((buffer != file->stage) && used)
+		memcpy(buffer, file->stage, used);
+	*staging = buffer;
+	return copied;
+}
+
+/*
+ * Queues the complete record of @param file in the pool buffer @param record,
+ * @param record_size bytes, for the commit at the end of the write.
+ * Caller must hold file->write_lock.
+ * @return 0 on success, -ENOMEM if the queue could not grow
+ */
+static int aesd_queue_record(struct aesd_file *file, char *record, size_t record_size)
+{
+	struct aesd_buffer_entry *ready;
+	uint32_t capacity;
+
+	if (file->ready_count == file->ready_capacity)
+	{
+		capacity = max(2 * file->ready_capacity, 8U);
+		ready = krealloc(file->ready, array_size(capacity, sizeof(*ready)), GFP_KERNEL);
+		if (!ready)
+			return -ENOMEM;
+		file->ready = ready;
+		file->ready_capacity = capacity;
+	}
+
+	file->ready[file->ready_count].buffptr = record;
+	file->ready[file->ready_count].size = record_size;
+	file->ready_count++;
 	return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-		loff_t *f_pos)
+/*
+ * Splits the complete records out of @param staging, which holds the @param used bytes
+ * staged by @param file and @param total - used bytes of the write after them, in a pool
+ * buffer of @param capacity. The first record keeps the buffer when it is of the same size
+ * class, the others and the bytes after the last newline are copied into buffers of their
+ * own size. The previous staging buffer is only freed once its bytes are held elsewhere.
+ * Caller must hold file->write_lock.
+ * @return total when every byte is queued or staged, else the offset where the first
+ * record which could not be queued starts, 0 with the staged bytes left as they were
+ */
+static size_t aesd_split_records(struct aesd_file *file, char *staging, size_t used,
+		size_t total, size_t capacity)
+{
+	size_t start = 0, end;
+	bool kept = false;
+	char *newline, *buffer;
+
+	while ((newline = memchr(staging + max(start, used), '\n', total - max(start, used))))
+	{
+		end = newline - staging + 1;
+		if (!start && (aesd_pool_capacity(end) == capacity))
+			buffer = staging;
+		else if ((buffer = aesd_pool_alloc(end - start)))
+			memcpy(buffer, staging + start, end - start);
+
+		if (!buffer)
+			break;
+		if (aesd_queue_record(file, buffer, end - start) != 0)
+		{
+			if (buffer != staging)
+				aesd_pool_free(buffer, end - start);
+			break;
+		}
+		kept |= (buffer == staging);
+		start = end;
+	}
+
+	// The bytes after the last newline stay staged
+	if (!newline && (start < total))
+	{
+		if (!start && (aesd_pool_capacity(total) == capacity))
+			buffer = staging;
+		else if ((buffer = aesd_pool_alloc(total - start)))
+			memcpy(buffer, staging + start, total - start);
+
+		if (buffer)
+		{
+			if (buffer == staging)
+				kept = true;
+			else if (!kept)
+				aesd_pool_free(staging, capacity);
+			if ((file->stage != staging) && file->stage)
+				aesd_pool_free(file->stage, used);
+			file->stage = buffer;
+			file->stage_size = total - start;
+			return total;
+		}
+	}
+	if (!start)
+	{
+		if (staging != file->stage)
+			aesd_pool_free(staging, capacity);
+		return 0;
+	}
+
+	if (!kept)
+		aesd_pool_free(staging, capacity);
+	if ((file->stage != staging) && file->stage)
+		aesd_pool_free(file->stage, used);
+	file->stage = NULL;
+	file->stage_size = 0;
+	return start;
+}
+
+/*
+ * Stages the data in @param from in the pool buffers of @param file without the device
+ * lock, every newline queues a complete record. Each byte is copied from user memory once
+ * and records are split out of the chunk without going back to it. With a byte ring a
+ * record longer than the ring is dropped, its bytes are not counted.
+ * Caller must hold file->write_lock.
+ * @return the number of bytes consumed, -ENOMEM, -EFAULT or -EMSGSIZE when nothing was
+ */
+static ssize_t aesd_stage_write(struct aesd_file *file, struct iov_iter *from)
+{
+	struct aesd_dev *dev = file->dev;
+	size_t written = 0, record_written = 0;
+
+	while (iov_iter_count(from) > 0)
+	{
+		size_t used = file->stage_size;
+		size_t remaining = min(iov_iter_count(from), max(AESD_STAGE_CHUNK, used));
+		size_t capacity, total, staged;
+		ssize_t chunk;
+		char *staging;
+
+		if (dev->ring.data)
+		{
+			if (used >= dev->ring.size)
+			{
+				aesd_pool_free(file->stage, used);
+				file->stage = NULL;
+				file->stage_size = 0;
+
+				// Records queued before the dropped one are still committed and reported
+				written -= record_written;
+				return written ? written : -EMSGSIZE;
+			}
+			remaining = min(remaining, dev->ring.size - used);
+		}
+
+		chunk = aesd_stage_chunk(file, from, remaining, &staging);
+		if (chunk < 0)
+			return written ? written : chunk;
+
+		capacity = aesd_pool_capacity((staging == file->stage) ? used : used + remaining);
+		total = used + chunk;
+		staged = aesd_split_records(file, staging, used, total, capacity);
+
+		// Bytes neither queued nor staged are given back to the caller
+		if (staged < total)
+		{
+			iov_iter_revert(from, total - max(staged, used));
+			if (staged > used)
+				written += staged - used;
+			return written ? written : -ENOMEM;
+		}
+
+		// Once a record was split off, the bytes staged are all from this write
+		record_written = (file->stage_size == total) ? record_written + chunk : file->stage_size;
+		written += chunk;
+	}
+
+	return written;
+}
+
+/*
+ * Makes the pending entries of @param dev visible to lockless readers in one write
+ * section of dev->seq. Caller must hold dev->lock.
+ * @return true if any entry was published
+ */
+static bool aesd_publish_records(struct aesd_dev *dev)
+{
+	if (!dev->pending)
+		return false;
+
+	write_seqcount_begin(&dev->seq);
+	dev->pending = 0;
+	dev->pending_bytes = 0;
+	write_seqcount_end(&dev->seq);
+	return true;
+}
+
+/*
+ * Takes dev->lock of @param dev for a batch of aesd_commit_record() calls. The records
+ * are consumed already and nothing here touches user memory, so the lock is taken
+ * without giving in to signals.
+ */
+static void aesd_commit_begin(struct aesd_dev *dev)
+{
+	aesd_reserve_batch(dev);
+	mutex_lock(&dev->lock);
+	aesd_mmap_view_batch_begin(&dev->view);
+}
+
+/*
+ * Publishes the records committed since aesd_commit_begin() together and releases dev->lock
+ * of @param dev.
+ */
+static void aesd_commit_end(struct aesd_dev *dev)
+{
+	bool published;
+
+	aesd_mmap_view_batch_end(&dev->view);
+	published = aesd_publish_records(dev);
+	aesd_retire_flush(dev);
+	mutex_unlock(&dev->lock);
+
+	// One wake up per batch however many records it committed
+	if (published)
+		wake_up_interruptible_poll(&dev->readq, EPOLLIN | EPOLLRDNORM);
+}
+
+/*
+ * Commits the records queued by the write of @param file and publishes them together.
+ */
+static void aesd_commit_queued(struct aesd_file *file)
+{
+	struct aesd_dev *dev = file->dev;
+	uint64_t mono_ns, real_ns;
+	uint32_t i;
+
+	aesd_commit_begin(dev);
+
+	// Stamped under the lock, so commit times never go back from one entry to the next
+	mono_ns = ktime_get_ns();
+	real_ns = ktime_get_real_ns();
+	for (i = 0; i < file->ready_count; i++)
+	{
+		file->ready[i].mono_ns = mono_ns;
+		file->ready[i].real_ns = real_ns;
+		aesd_commit_record(dev, &file->ready[i]);
+	}
+
+	aesd_commit_end(dev);
+	file->ready_count = 0;
+}
+
+/*
+ * Complete records staged on one CPU when aesd_merge_usecs is set, in the order they
+ * were stamped. A write whose records do not fit commits them with a merge instead.
+ */
+#define AESD_MERGE_RECORDS 64
+
+struct aesd_cpu_stage
+{
+	spinlock_t lock;
+	uint32_t count;
+	struct aesd_buffer_entry records[AESD_MERGE_RECORDS];
+};
+
+/*
+ * A record taken by a merge, with its CPU and queue position to order records of equal
+ * commit time
+ */
+struct aesd_merge_record
+{
+	struct aesd_buffer_entry record;
+	uint32_t cpu;
+	uint32_t position;
+};
+
+static int aesd_merge_cmp(const void *a, const void *b)
+{
+	const struct aesd_merge_record *left = a, *right = b;
+
+	if (left->record.mono_ns != right->record.mono_ns)
+		return (left->record.mono_ns < right->record.mono_ns) ? -1 : 1;
+	if (left->cpu != right->cpu)
+		return (left->cpu < right->cpu) ? -1 : 1;
+	return (left->position < right->position) ? -1 : (left->position > right->position);
+}
+
+/*
+ * Starts the merge timer of @param dev, aesd_merge_usecs from now, unless it is running
+ * already for records staged before. An hrtimer keeps the bound in microseconds, where
+ * a delayed work would wait at least one jiffy.
+ */
+static void aesd_merge_arm(struct aesd_dev *dev)
+{
+	if (!hrtimer_active(&dev->merge_timer))
+		hrtimer_start(&dev->merge_timer, ns_to_ktime((u64)aesd_merge_usecs * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+}
+
+/*
+ * Commits the records every CPU staged for @param dev before the merge started, or all
+ * of them with @param all, in commit time order. The records queued by the write of
+ * @param file follow them, stamped with the start of the merge, unless file is NULL.
+ * All of them are published together. Only unload passes all, when no writer can stage
+ * any more.
+ */
+static void aesd_merge_staged(struct aesd_dev *dev, struct aesd_file *file, bool all)
+{
+	struct aesd_cpu_stage *stage;
+	uint32_t count = 0, taken, i;
+	uint64_t cutoff, real_ns;
+	bool left = false;
+	int cpu;
+
+	aesd_commit_begin(dev);
+
+	// A record is stamped under its queue lock, one this merge misses is stamped after cutoff
+	cutoff = all ? U64_MAX : ktime_get_ns();
+	real_ns = ktime_get_real_ns();
+	for_each_possible_cpu(cpu)
+	{
+		stage = per_cpu_ptr(dev->cpu_stage, cpu);
+		spin_lock(&stage->lock);
+		for (taken = 0; (taken < stage->count) && (stage->records[taken].mono_ns < cutoff); taken++)
+		{
+			dev->merge[count].record = stage->records[taken];
+			dev->merge[count].cpu = cpu;
+			dev->merge[count].position = taken;
+			count++;
+		}
+		stage->count -= taken;
+		memmove(stage->records, stage->records + taken, stage->count * sizeof(struct aesd_buffer_entry));
+		left |= (stage->count != 0);
+		spin_unlock(&stage->lock);
+	}
+
+	// Every queue is in order already, sorting interleaves them
+	sort(dev->merge, count, sizeof(struct aesd_merge_record), aesd_merge_cmp, NULL);
+	for (i = 0; i < count; i++)
+		aesd_commit_record(dev, &dev->merge[i].record);
+
+	// Records staged after this merge are stamped at cutoff or later, so they still follow
+	for (i = 0; file && (i < file->ready_count); i++)
+	{
+		file->ready[i].mono_ns = cutoff;
+		file->ready[i].real_ns = real_ns;
+		aesd_commit_record(dev, &file->ready[i]);
+	}
+
+	aesd_commit_end(dev);
+
+	// Records stamped after cutoff go with the next merge
+	if (left)
+		aesd_merge_arm(dev);
+}
+
+static void aesd_merge_work(struct work_struct *work)
+{
+	struct aesd_dev *dev = container_of(work, struct aesd_dev, merge_work);
+
+	aesd_merge_staged(dev, NULL, false);
+}
+
+/*
+ * Hands the merge of @param timer's device to the system workqueue, a merge takes
+ * dev->lock and the timer runs in interrupt context.
+ */
+static enum hrtimer_restart aesd_merge_timer(struct hrtimer *timer)
+{
+	struct aesd_dev *dev = container_of(timer, struct aesd_dev, merge_timer);
+
+	schedule_work(&dev->merge_work);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Stages the records queued by the write of @param file on the current CPU, without
+ * dev->lock. The merge work commits them within aesd_merge_usecs, the first record of
+ * an empty queue schedules it. The records of one write are staged together or not at
+ * all, when they do not fit a merge commits them right after those staged before.
+ */
+static void aesd_stage_queued(struct aesd_file *file)
+{
+	struct aesd_dev *dev = file->dev;
+	struct aesd_cpu_stage *stage;
+	uint64_t mono_ns, real_ns;
+	bool staged = false, first = false;
+	uint32_t i;
+
+	stage = get_cpu_ptr(dev->cpu_stage);
+	spin_lock(&stage->lock);
+	if (file->ready_count <= AESD_MERGE_RECORDS - stage->count)
+	{
+		mono_ns = ktime_get_ns();
+		real_ns = ktime_get_real_ns();
+		first = (stage->count == 0);
+		for (i = 0; i < file->ready_count; i++)
+		{
+			file->ready[i].mono_ns = mono_ns;
+			file->ready[i].real_ns = real_ns;
+			stage->records[stage->count++] = file->ready[i];
+		}
+		staged = true;
+	}
+	spin_unlock(&stage->lock);
+	put_cpu_ptr(dev->cpu_stage);
+
+	if (!staged)
+		aesd_merge_staged(dev, file, false);
+	else if (first)
+		aesd_merge_arm(dev);
+
+	file->ready_count = 0;
+}
+
+/*
+ * Continues the record a closed file left unterminated in @param file, unless it
+ * stages a record of its own. Caller must hold file->write_lock.
+ */
+static void aesd_adopt_record(struct aesd_file *file)
+{
+	struct aesd_dev *dev = file->dev;
+
+	if (file->stage_size || !READ_ONCE(dev->temp_buffer_size))
+		return;
+
+	mutex_lock(&dev->lock);
+	file->stage = dev->temp_buffer;
+	file->stage_size = dev->temp_buffer_size;
+	dev->temp_buffer = NULL;
+	dev->temp_buffer_size = 0;
+	mutex_unlock(&dev->lock);
+}
+
+/*
+ * Description: Kernel write implementation. Partial records are staged per open file,
+ * the device lock is only taken to commit complete ones. All records of one write,
+ * a writev() of several iovecs included, become visible to readers together.
+ * iocb: the kiocb of the file written to
+ * from: the user data
+ */
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
 	ssize_t retval = 0;
-	PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
+	size_t staged;
+
+	if((iocb == NULL) || (from == NULL))
+	{
+		return -EINVAL;
+	}
+
+	PDEBUG("write %zu bytes with offset %lld",iov_iter_count(from),iocb->ki_pos);
+
+	struct aesd_file *file = iocb->ki_filp->private_data;
+	struct aesd_dev *dev = file->dev;
+
+	// Writers of other files stage in parallel, only writers sharing this file wait here
+	if(mutex_lock_interruptible(&file->write_lock) != 0)
+	{
+		PDEBUG("Error in write mutex locking");
+		return -ERESTARTSYS;
+	}
+
+	aesd_adopt_record(file);
+	staged = file->stage_size;
+
+	// Report the bytes consumed before a failure, the error only when nothing was
+	retval = aesd_stage_write(file, from);
+
+	// Records queued before a failure are committed with the short write
+	if (file->ready_count && dev->cpu_stage)
+		aesd_stage_queued(file);
+	else if (file->ready_count)
+		aesd_commit_queued(file);
+
+	atomic64_add((long long)file->stage_size - (long long)staged, &dev->staged_bytes);
+	mutex_unlock(&file->write_lock);
+
+	if (retval > 0)
+		iocb->ki_pos += retval;  // Update file position
+
+	return retval;
+}
+
+/*
+ * Description: Kernel lseek implementation
+ * file: File structure to seek on
+ * offset: file offset to seek to
+ * whence: type of seek
+ */
+loff_t aesd_llseek(struct file *file, loff_t offset, int whence)
+{
+	PDEBUG("Start of llseek");
+	loff_t retval;
+	struct aesd_file *private = file->private_data;
+	struct aesd_dev *dev = private->dev;
+	unsigned int seq;
+	uint64_t base;
+	size_t size;
+
+	// The concatenated size is all llseek needs, read it without the lock
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		base = dev->buffer.base;
+		size = aesd_published_tail(dev) - base;
+	} while (read_seqcount_retry(&dev->seq, seq));
+
+	retval = fixed_size_llseek(file, offset, whence, size);
+	PDEBUG("Return Value from fixed size llseek: %lld", retval);
+
+	// A following reader continues from the new offset
+	if ((retval >= 0) && private->follow)
+		private->follow_stream = base + retval;
+
+	PDEBUG("End of llseek");
+	return retval;
+}
+
+/*
+ * Adjust the file offset (f_pos) parameter filp based on the location specified by 
+ * @param write_cmd (referenced command to locate)
+ * and @param write_cmd_offset (the zero referenced offset command to locate)
+ * @ return 0 if successful, negative if error occured
+ * 	ERESTARTSYS if mutex cound not be obtained
+ * 	EINVAL if write_cmd or write_cmd_offset was out of range
+ */
+static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset)
+{
+	long retval = 0;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	struct aesd_buffer_entry *entry;
+	size_t entry_char_offset = 0;
+	size_t entry_size = 0;
+	unsigned int seq;
+
+	rcu_read_lock();
+	do
+	{
+		entry = NULL;
+		seq = read_seqcount_begin(&dev->seq);
+		aesd_buffer_snapshot(dev, &snapshot);
+		if (read_seqcount_retry(&dev->seq, seq))
+			continue;
+
+		// write_cmd counts from the oldest entry still held, its offset comes from the prefix sums
+		entry = aesd_circular_buffer_entry_at(&snapshot, write_cmd, &entry_char_offset);
+		if (entry)
+			entry_size = entry->size;
+	} while (read_seqcount_retry(&dev->seq, seq));
+	rcu_read_unlock();
+
+	// Check for valid write_cmd and write_cmd_offset
+	if ((entry == NULL) || (write_cmd_offset >= entry_size))
+	{
+		retval = -EINVAL;
+		return retval;
+	}
+
+	filp->f_pos = entry_char_offset + write_cmd_offset;  // Updating file pointer with new located offset
+	if (file->follow)
+		file->follow_stream = snapshot.base + filp->f_pos;
+
+	return retval;	// Success case where retval is zero
+}
+
+/*
+ * Replaces the circular buffer of @param dev with one holding @param capacity entries.
+ * The newest entries are kept, the oldest ones are freed when they no longer fit.
+ * @ return 0 if successful, negative if error occured
+ * 	EINVAL if capacity is 0 or above AESDCHAR_MAX_CAPACITY
+ * 	ENOMEM if the new entry array could not be allocated
+ * 	ERESTARTSYS if mutex cound not be obtained
+ */
+static long aesd_resize_buffer(struct aesd_dev *dev, uint32_t capacity)
+{
+	struct aesd_circular_buffer resized;
+	struct aesd_buffer_entry *entries;
+	struct aesd_buffer_entry *retired_entries;
+	uint32_t held, i;
 
-	if((filp == NULL) || (buf == NULL))
-	{
+	if ((capacity == 0) || (capacity > AESDCHAR_MAX_CAPACITY))
 		return -EINVAL;
-	}
 
-	/**
-	 * TODO: handle read
-	 */
-	struct aesd_buffer_entry *entry;
-	size_t entry_offset_byte = 0;
-	struct aesd_dev *dev = filp->private_data;
+	entries = kvmalloc_array(capacity, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+	if (!entries)
+		return -ENOMEM;
+	aesd_circular_buffer_init_capacity(&resized, entries, capacity);
+	aesd_reserve_batch(dev);
 
-	// Lock aesd device
-	if(mutex_lock_interruptible(&dev->lock) != 0)
+	if (mutex_lock_interruptible(&dev->lock) != 0)
 	{
-		PDEBUG("Error in read mutex locking");
+		kvfree(entries);
 		return -ERESTARTSYS;
 	}
 
-	entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &entry_offset_byte);
-
-	if(entry)
-	{
-		size_t remaining_bytes = entry->size - entry_offset_byte;
-		size_t bytes_to_copy = min(remaining_bytes, count);
-
-		if (copy_to_user(buf, entry->buffptr + entry_offset_byte, bytes_to_copy)) 
-		{
-			retval = -EFAULT;
-		} 
-		else 
-		{
-			retval = bytes_to_copy;
-			*f_pos += retval;
-		}
-	}
+	// Drop the oldest entries which do not fit, then copy the rest in order
+	held = aesd_circular_buffer_count(&dev->buffer);
+	if (held > capacity)
+		aesd_evict_oldest(dev, held - capacity);
+	aesd_retire_flush(dev);
+
+	// Stream positions carry over so offsets held by readers keep their meaning
+	resized.base = dev->buffer.base;
+	resized.tail = dev->buffer.base;
+	resized.base_seq = dev->buffer.base_seq;
+	held = aesd_circular_buffer_count(&dev->buffer);
+	for (i = 0; i < held; i++)
+		aesd_circular_buffer_add_entry(&resized, aesd_circular_buffer_entry_at(&dev->buffer, i, NULL));
+
+	retired_entries = dev->buffer.entry;
+	write_seqcount_begin(&dev->seq);
+	dev->buffer = resized;
+	write_seqcount_end(&dev->seq);
+	aesd_mmap_view_trim(&dev->view, held);
 
-	// Unlock the mutex
 	mutex_unlock(&dev->lock);
 
-	return retval;
+	// Lockless readers may still walk the old array
+	synchronize_rcu();
+	kvfree(retired_entries);
+
+	PDEBUG("resized to %u entries", capacity);
+	return 0;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-		loff_t *f_pos)
+/*
+ * Fills @param stats with the current occupancy of @param dev
+ * @ return 0 if successful, ERESTARTSYS if mutex cound not be obtained
+ */
+static long aesd_get_stats(struct aesd_dev *dev, struct aesd_stats *stats)
 {
-	ssize_t retval = -ENOMEM;
-
-	if((filp == NULL) || (buf == NULL))
-	{
-		return -EINVAL;
-	}
-
-	PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
-	/**
-	 * TODO: handle write
-	 */
+	memset(stats, 0, sizeof(*stats));
 
-	struct aesd_dev *dev = filp->private_data;
-
-	char *write_data = kmalloc(count, GFP_KERNEL);
+	if (mutex_lock_interruptible(&dev->lock) != 0)
+		return -ERESTARTSYS;
 
-	// Check for kmalloc failure
-	if(!write_data)
-	{
-		PDEBUG("Kmalloc failed while writing");
-		return retval;
-	}
+	stats->entries = aesd_circular_buffer_count(&dev->buffer);
+	stats->capacity = dev->buffer.capacity;
+	stats->bytes = aesd_circular_buffer_size(&dev->buffer);
+	stats->staged_bytes = atomic64_read(&dev->staged_bytes);
+	stats->high_water_bytes = dev->buffer_size_hwm;
+	stats->budget_bytes = READ_ONCE(aesd_budget);
+	stats->evictions = dev->evictions;
 
-	if (copy_from_user(write_data, buf, count)) 
-	{
-		retval = -EFAULT;
-		kfree(write_data);
-		return retval;
-	}
+	mutex_unlock(&dev->lock);
+	return 0;
+}
 
-	// Lock the mutex
-	if(mutex_lock_interruptible(&dev->lock) != 0)
-	{
-		PDEBUG("Error in write mutex locking");
-		retval = -ERESTARTSYS;
-		return retval;
-	}
+/*
+ * Fills @param index with the head and tail sequence numbers and held bytes of @param dev,
+ * and describes up to index->max_records records from index->first_seq on in the user
+ * array at index->records. The records are read in one go under the lock, the copy to
+ * userspace happens after it.
+ * @ return 0 if successful, EINVAL if first_seq has not been committed yet, ENOMEM, EFAULT
+ * or ERESTARTSYS
+ */
+static long aesd_get_index(struct aesd_dev *dev, struct aesd_index *index)
+{
+	uint32_t max_records = min(index->max_records, READ_ONCE(dev->buffer.capacity));
+	struct aesd_record *records;
+	uint64_t next_seq;
+	uint32_t i, count = 0;
+	long retval = 0;
 
-	size_t write_index = 0;  // Index for writing into the buffer
-	bool newline_found = false;
+	records = kvmalloc_array(max(max_records, 1U), sizeof(struct aesd_record), GFP_KERNEL);
+	if (!records)
+		return -ENOMEM;
 
-	// Iterate through the write command and handle newline characters
-	while (write_index < count) 
+	if (mutex_lock_interruptible(&dev->lock) != 0)
 	{
-		if (write_data[write_index] == '\n') 
-		{
-			newline_found = true;
-			break;
-		}
-		write_index++;
+		kvfree(records);
+		return -ERESTARTSYS;
 	}
 
-	size_t append_index = 0;
-
-	if(newline_found == true)
-		append_index = write_index + 1;
-	else
-		append_index = count;
-	if(dev->temp_buffer_size == 0)
+	next_seq = aesd_circular_buffer_next_seq(&dev->buffer);
+	if (index->first_seq > next_seq)
 	{
-		dev->temp_buffer = kmalloc(count, GFP_KERNEL);
-		if(!(dev->temp_buffer))
-		{
-			kfree(write_data);
-			mutex_unlock(&dev->lock);
-			return retval;
-		}
+		retval = -EINVAL;
 	}
 	else
 	{
-		dev->temp_buffer = krealloc(dev->temp_buffer, (append_index + dev->temp_buffer_size), GFP_KERNEL);
+		index->first_seq = max(index->first_seq, dev->buffer.base_seq);
+		index->head_seq = dev->buffer.base_seq;
+		index->tail_seq = next_seq;
+		index->bytes = aesd_circular_buffer_size(&dev->buffer);
 
-		if(!(dev->temp_buffer))
+		count = min_t(uint64_t, max_records, next_seq - index->first_seq);
+		for (i = 0; i < count; i++)
 		{
-			kfree(write_data);
-			mutex_unlock(&dev->lock);
-			return retval;
+			struct aesd_buffer_entry *entry = aesd_circular_buffer_entry_at(&dev->buffer,
+					index->first_seq - dev->buffer.base_seq + i, NULL);
+
+			records[i].seq = index->first_seq + i;
+			records[i].size = entry->size;
+			records[i].mono_ns = entry->mono_ns;
+			records[i].real_ns = entry->real_ns;
 		}
 	}
 
-	memcpy(dev->temp_buffer + dev->temp_buffer_size, write_data, append_index);
-	dev->temp_buffer_size += (append_index);
-
+	mutex_unlock(&dev->lock);
 
-	if (newline_found)
-	{
-		struct aesd_buffer_entry add_entry;
+	index->nr_records = count;
+	if ((retval == 0) && count &&
+			(copy_to_user(u64_to_user_ptr(index->records), records, count * sizeof(struct aesd_record)) != 0))
+		retval = -EFAULT;
 
-		add_entry.size = dev->temp_buffer_size;
-		add_entry.buffptr = dev->temp_buffer;
+	kvfree(records);
+	return retval;
+}
 
-		PDEBUG("New Buffer: %s", dev->temp_buffer);
+/*
+ * Copies the records of @param dev from copy->first_seq on back to back into the user buffer
+ * at copy->data and describes each in the user array at copy->slices, as many as fit in
+ * both. The data is copied holding the lock, which keeps the records from being evicted,
+ * so copy->data_size bounds how long writers wait.
+ * @ return 0 if successful, EINVAL if first_seq has not been committed yet, EMSGSIZE when
+ * the first record does not fit, ENOMEM, EFAULT or ERESTARTSYS
+ */
+static long aesd_get_records(struct aesd_dev *dev, struct aesd_records_copy *copy)
+{
+	uint32_t max_records = min(copy->max_records, READ_ONCE(dev->buffer.capacity));
+	char __user *data = u64_to_user_ptr(copy->data);
+	struct aesd_record_slice *slices;
+	uint64_t record_seq, next_seq;
+	uint64_t offset = 0;
+	uint32_t count = 0;
+	long retval = 0;
 
-		struct aesd_buffer_entry *oldest_entry = NULL;
+	slices = kvmalloc_array(max(max_records, 1U), sizeof(struct aesd_record_slice), GFP_KERNEL);
+	if (!slices)
+		return -ENOMEM;
 
-		if (dev->buffer.full)
-		{
-			oldest_entry = &dev->buffer.entry[dev->buffer.in_offs];		
-			if(oldest_entry->buffptr)
-				kfree(oldest_entry->buffptr);
-			oldest_entry->buffptr = NULL;
-			oldest_entry->size = 0;
-		}
+	if (mutex_lock_interruptible(&dev->lock) != 0)
+	{
+		kvfree(slices);
+		return -ERESTARTSYS;
+	}
 
+	next_seq = aesd_circular_buffer_next_seq(&dev->buffer);
+	if (copy->first_seq > next_seq)
+		retval = -EINVAL;
+	copy->first_seq = max(copy->first_seq, dev->buffer.base_seq);
+	record_seq = copy->first_seq;
 
-		aesd_circular_buffer_add_entry(&dev->buffer, &add_entry);
+	while ((retval == 0) && (count < max_records) && (record_seq < next_seq))
+	{
+		const struct aesd_buffer_entry *entry = aesd_circular_buffer_entry_at(&dev->buffer,
+				record_seq - dev->buffer.base_seq, NULL);
 
-		// buffer_size is used for seeking functionality
-		dev->buffer_size += add_entry.size; // Updating concatenated circular buffer length
+		if (entry->size > copy->data_size - offset)
+			break;
+		if (copy_to_user(data + offset, entry->buffptr, entry->size) != 0)
+			retval = -EFAULT;
 
-		dev->temp_buffer_size = 0;
+		slices[count].seq = record_seq;
+		slices[count].offset = offset;
+		slices[count].size = entry->size;
+		offset += entry->size;
+		record_seq++;
+		count++;
 	}
 
-	retval = append_index;
-
-	if(write_data)
-		kfree(write_data);
-
-	// Unlock the mutex
 	mutex_unlock(&dev->lock);
 
-	*f_pos += retval;  // Update file position
+	if ((retval == 0) && (count == 0) && (record_seq < next_seq) && max_records)
+		retval = -EMSGSIZE;
+
+	copy->nr_records = count;
+	if ((retval == 0) && count &&
+			(copy_to_user(u64_to_user_ptr(copy->slices), slices, count * sizeof(struct aesd_record_slice)) != 0))
+		retval = -EFAULT;
 
+	kvfree(slices);
 	return retval;
 }
 
-
 /*
- * Description: Kernel lseek implementation
- * file: File structure to seek on
- * offset: file offset to seek to
- * whence: type of seek
+ * Makes reads of @param filp at the newest record wait for the next one when @param follow
+ * is nonzero. A following reader keeps its place in the stream across evictions, starting
+ * from the current file offset.
+ * @ return 0 if successful, EINVAL if the file offset is past the end of the buffer
  */
-loff_t aesd_llseek(struct file *file, loff_t offset, int whence)
+static long aesd_set_follow(struct file *filp, uint32_t follow)
 {
-	PDEBUG("Start of llseek");
-	loff_t retval;
-	struct aesd_dev *dev = file->private_data;
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	unsigned int seq;
+	uint64_t base;
+	size_t size;
 
-	mutex_lock(&aesd_device.lock);
-	retval = fixed_size_llseek(file, offset, whence, dev->buffer_size);
-	PDEBUG("Return Value from fixed size llseek: %lld", retval);
-	mutex_unlock(&aesd_device.lock);
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		base = dev->buffer.base;
+		size = aesd_published_tail(dev) - base;
+	} while (read_seqcount_retry(&dev->seq, seq));
 
-	PDEBUG("End of llseek");
-	return retval;
+	if (filp->f_pos > size)
+		return -EINVAL;
+
+	file->follow_stream = base + filp->f_pos;
+	file->follow = (follow != 0);
+	return 0;
 }
 
 /*
- * Adjust the file offset (f_pos) parameter filp based on the location specified by 
- * @param write_cmd (referenced command to locate)
- * and @param write_cmd_offset (the zero referenced offset command to locate)
- * @ return 0 if successful, negative if error occured
- * 	ERESTARTSYS if mutex cound not be obtained
- * 	EINVAL if write_cmd or write_cmd_offset was out of range
+ * Moves @param filp to the record with sequence number @param record_seq, or to the oldest
+ * record held when that one was evicted, and stores the number moved to in record_seq.
+ * The number of the next record to be committed moves past the newest one.
+ * @ return 0 if successful, EINVAL if the record has not been committed yet
  */
-static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd, unsigned int write_cmd_offset)
+static long aesd_seek_seq(struct file *filp, uint64_t *record_seq)
 {
-	long retval = 0;
-	struct aesd_dev *dev = filp->private_data;
-	loff_t updated_fpos_offset = 0;
-
-	mutex_lock(&aesd_device.lock);
-
-	// Check for valid write_cmd
-	if (write_cmd >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	uint64_t target, next_seq;
+	size_t char_offset;
+	unsigned int seq;
+
+	rcu_read_lock();
+	do
 	{
-		retval = -EINVAL;
-		mutex_unlock(&aesd_device.lock);
-		return retval;
+		seq = read_seqcount_begin(&dev->seq);
+		aesd_buffer_snapshot(dev, &snapshot);
+		if (read_seqcount_retry(&dev->seq, seq))
+			continue;
+
+		next_seq = aesd_circular_buffer_next_seq(&snapshot);
+		target = max(*record_seq, snapshot.base_seq);
+		char_offset = aesd_circular_buffer_size(&snapshot);
+		if (target < next_seq)
+			aesd_circular_buffer_entry_at(&snapshot, target - snapshot.base_seq, &char_offset);
+	} while (read_seqcount_retry(&dev->seq, seq));
+	rcu_read_unlock();
+
+	if (*record_seq > next_seq)
+		return -EINVAL;
 
-	}
+	filp->f_pos = char_offset;
+	file->record_seq = target;
+	if (file->follow)
+		file->follow_stream = snapshot.base + char_offset;
 
-	// Check for valid_cmd_offset
-	if (write_cmd_offset >= dev->buffer.entry[write_cmd].size)
-	{
-		retval = -EINVAL;
-		mutex_unlock(&aesd_device.lock);
-		return retval;
+	*record_seq = target;
+	return 0;
+}
 
-	}
+/*
+ * Moves @param filp to the oldest record committed at or after @param seektime time_ns on
+ * its clock, or past the newest record when all are older, and stores that record's
+ * sequence number in seektime. Commit times are searched by bisection, CLOCK_REALTIME
+ * ones are only ordered as long as the clock was not set back.
+ * @ return 0 if successful, EINVAL for any other clock
+ */
+static long aesd_seek_time(struct file *filp, struct aesd_seektime *seektime)
+{
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	uint64_t record_seq;
+	unsigned int seq;
+
+	if ((seektime->clock != CLOCK_MONOTONIC) && (seektime->clock != CLOCK_REALTIME))
+		return -EINVAL;
 
-	unsigned int i = 0;
-	for (i = 0; i < write_cmd; i++)
+	rcu_read_lock();
+	do
 	{
-		updated_fpos_offset += dev->buffer.entry[i].size;
-	}
+		seq = read_seqcount_begin(&dev->seq);
+		aesd_buffer_snapshot(dev, &snapshot);
+		if (read_seqcount_retry(&dev->seq, seq))
+			continue;
+
+		record_seq = snapshot.base_seq + aesd_circular_buffer_find_entry_for_time(&snapshot,
+				seektime->time_ns, seektime->clock == CLOCK_REALTIME);
+	} while (read_seqcount_retry(&dev->seq, seq));
+	rcu_read_unlock();
+
+	// Records evicted since then move the seek on to the oldest one held
+	seektime->seq = record_seq;
+	return aesd_seek_seq(filp, &seektime->seq);
+}
 
-	filp->f_pos = updated_fpos_offset + write_cmd_offset;  // Updating file pointer with new located offset
+/*
+ * Makes reads of @param filp return whole records when @param records is nonzero, starting
+ * with the record holding the current file offset.
+ * @ return 0
+ */
+static long aesd_set_records(struct file *filp, uint32_t records)
+{
+	struct aesd_file *file = filp->private_data;
+	struct aesd_dev *dev = file->dev;
+	struct aesd_circular_buffer snapshot;
+	struct aesd_buffer_entry *entry;
+	uint64_t position, record_seq;
+	size_t offset;
+	unsigned int seq;
 
-	mutex_unlock(&aesd_device.lock);
-	return retval;	// Success case where retval is zero
+	rcu_read_lock();
+	do
+	{
+		seq = read_seqcount_begin(&dev->seq);
+		aesd_buffer_snapshot(dev, &snapshot);
+		if (read_seqcount_retry(&dev->seq, seq))
+			continue;
+
+		position = aesd_read_position(file, filp->f_pos, snapshot.base);
+		record_seq = snapshot.base_seq;
+		entry = NULL;
+		if (position >= snapshot.tail)
+			record_seq = aesd_circular_buffer_next_seq(&snapshot);
+		else if (position > snapshot.base)
+			entry = aesd_circular_buffer_find_entry_offset_for_fpos(&snapshot, position - snapshot.base, &offset);
+		if (entry)
+			record_seq += aesd_circular_buffer_entry_number(&snapshot, entry - snapshot.entry);
+	} while (read_seqcount_retry(&dev->seq, seq));
+	rcu_read_unlock();
+
+	file->record_seq = record_seq;
+	file->records = (records != 0);
+	return 0;
 }
 
-
 long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	long retval = 0;
+	struct aesd_file *file = filp->private_data;
 
 	// Unused ioctl command and maximum command supported bound checking
 	if ((_IOC_TYPE(cmd) != AESD_IOC_MAGIC) || (_IOC_NR(cmd) > AESDCHAR_IOC_MAXNR))
@@ -309,6 +1818,14 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		return retval;
 	}
 	struct aesd_seekto seekto;
+	uint32_t capacity;
+	uint32_t follow;
+	uint32_t records;
+	uint64_t record_seq;
+	struct aesd_stats stats;
+	struct aesd_index index;
+	struct aesd_records_copy records_copy;
+	struct aesd_seektime seektime;
 	switch (cmd)
 	{
 		case AESDCHAR_IOCSEEKTO:
@@ -318,42 +1835,288 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 				retval = aesd_adjust_file_offset(filp, seekto.write_cmd, seekto.write_cmd_offset);
 			break;
 
+		case AESDCHAR_IOCRESIZE:
+			if (copy_from_user(&capacity, (const void __user *)arg, sizeof(capacity)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_resize_buffer(file->dev, capacity);
+			break;
+
+		case AESDCHAR_IOCGSTATS:
+			retval = aesd_get_stats(file->dev, &stats);
+			if ((retval == 0) && (copy_to_user((void __user *)arg, &stats, sizeof(stats)) != 0))
+				retval = -EFAULT;
+			break;
+
+		case AESDCHAR_IOCFOLLOW:
+			if (copy_from_user(&follow, (const void __user *)arg, sizeof(follow)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_set_follow(filp, follow);
+			break;
+
+		case AESDCHAR_IOCSEEKSEQ:
+			if (copy_from_user(&record_seq, (const void __user *)arg, sizeof(record_seq)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_seek_seq(filp, &record_seq);
+			if ((retval == 0) && (copy_to_user((void __user *)arg, &record_seq, sizeof(record_seq)) != 0))
+				retval = -EFAULT;
+			break;
+
+		case AESDCHAR_IOCRECORDS:
+			if (copy_from_user(&records, (const void __user *)arg, sizeof(records)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_set_records(filp, records);
+			break;
+
+		case AESDCHAR_IOCGINDEX:
+			if (copy_from_user(&index, (const void __user *)arg, sizeof(index)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_get_index(file->dev, &index);
+			if ((retval == 0) && (copy_to_user((void __user *)arg, &index, sizeof(index)) != 0))
+				retval = -EFAULT;
+			break;
+
+		case AESDCHAR_IOCGRECORDS:
+			if (copy_from_user(&records_copy, (const void __user *)arg, sizeof(records_copy)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_get_records(file->dev, &records_copy);
+			if ((retval == 0) && (copy_to_user((void __user *)arg, &records_copy, sizeof(records_copy)) != 0))
+				retval = -EFAULT;
+			break;
+
+		case AESDCHAR_IOCSEEKTIME:
+			if (copy_from_user(&seektime, (const void __user *)arg, sizeof(seektime)) != 0)
+				retval = -EFAULT;
+			else
+				retval = aesd_seek_time(filp, &seektime);
+			if ((retval == 0) && (copy_to_user((void __user *)arg, &seektime, sizeof(seektime)) != 0))
+				retval = -EFAULT;
+			break;
+
 		default:
 			break;
 	}
 	return retval;
 }
 
+/*
+ * Description: Kernel mmap implementation, maps the read-only view of the newest records
+ */
+int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct aesd_file *file = filp->private_data;
+
+	return aesd_mmap_view_map(&file->dev->view, vma);
+}
+
+/*
+ * Description: Kernel fsync implementation, commits the records staged per CPU before
+ * the call so they are visible once it returns. Without aesd_merge_usecs every write
+ * is committed when it returns already.
+ */
+int aesd_fsync(struct file *filp, loff_t start, loff_t end, int datasync)
+{
+	struct aesd_file *file = filp->private_data;
+
+	if (file->dev->cpu_stage)
+		aesd_merge_staged(file->dev, NULL, false);
+	return 0;
+}
+
+/*
+ * Description: Kernel splice_read implementation, fills pipe pages through aesd_read_iter
+ * so sendfile() and splice() move records without a bounce through userspace.
+ * Record memory is recycled as soon as an entry is evicted, so pipe buffers get a copy
+ * rather than references to it.
+ */
+ssize_t aesd_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+		size_t len, unsigned int flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	return copy_splice_read(in, ppos, pipe, len, flags);
+#else
+	return generic_file_splice_read(in, ppos, pipe, len, flags);
+#endif
+}
+
 struct file_operations aesd_fops = {
 	.owner =    THIS_MODULE,
-	.read =     aesd_read,
-	.write =    aesd_write,
+	.read_iter = aesd_read_iter,
+	.splice_read = aesd_splice_read,
+	.write_iter = aesd_write_iter,
+	.fsync =    aesd_fsync,
+	.poll =     aesd_poll,
+	.mmap =     aesd_mmap,
 	.open =     aesd_open,
 	.release =  aesd_release,
 	.llseek = aesd_llseek,
 	.unlocked_ioctl = aesd_ioctl,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-	int err, devno = MKDEV(aesd_major, aesd_minor);
+	int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
 	cdev_init(&dev->cdev, &aesd_fops);
 	dev->cdev.owner = THIS_MODULE;
 	dev->cdev.ops = &aesd_fops;
 	err = cdev_add (&dev->cdev, devno, 1);
 	if (err) {
-		printk(KERN_ERR "Error %d adding aesd cdev", err);
+		printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
 	}
 	return err;
 }
 
+/*
+ * Allocates the per CPU queues of @param dev and the array a merge sorts their records in.
+ * @return 0 on success, -ENOMEM
+ */
+static int aesd_setup_merge(struct aesd_dev *dev)
+{
+	int cpu;
+
+	dev->cpu_stage = alloc_percpu(struct aesd_cpu_stage);
+	dev->merge = kvmalloc_array(nr_cpu_ids * AESD_MERGE_RECORDS, sizeof(struct aesd_merge_record), GFP_KERNEL);
+	if (!dev->cpu_stage || !dev->merge)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(dev->cpu_stage, cpu)->lock);
+	return 0;
+}
+
+/*
+ * Initializes @param dev with its own records, lock and statistics and makes it live as
+ * minor aesd_minor + @param index. The size class caches of the pool are shared.
+ * @return 0 on success, -EINVAL if aesd_capacity is out of range, -ENOMEM if the
+ * entries could not be allocated or the error of the ring, the merge queues, the mmap
+ * view or cdev_add()
+ */
+static int aesd_setup_dev(struct aesd_dev *dev, unsigned int index)
+{
+	struct aesd_buffer_entry *entries;
+	int result = 0;
+
+	if ((aesd_capacity == 0) || (aesd_capacity > AESDCHAR_MAX_CAPACITY))
+	{
+		printk(KERN_WARNING "aesd_capacity %u out of range\n", aesd_capacity);
+		return -EINVAL;
+	}
+
+	entries = kvmalloc_array(aesd_capacity, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+	if (!entries)
+	{
+		printk(KERN_WARNING "Can't allocate %u aesdchar entries\n", aesd_capacity);
+		return -ENOMEM;
+	}
+	aesd_circular_buffer_init_capacity(&dev->buffer, entries, aesd_capacity);  // Initializing buffer
+	mutex_init(&dev->lock);  // Mutex Initialization
+	seqcount_mutex_init(&dev->seq, &dev->lock);
+	init_waitqueue_head(&dev->readq);
+	init_llist_head(&dev->retired);
+	init_llist_head(&dev->spare_batches);
+	INIT_WORK(&dev->reclaim_work, aesd_reclaim_work);
+	INIT_WORK(&dev->merge_work, aesd_merge_work);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&dev->merge_timer, aesd_merge_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&dev->merge_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	dev->merge_timer.function = aesd_merge_timer;
+#endif
+
+	if (aesd_ring_size)
+		result = aesd_byte_ring_init(&dev->ring, aesd_ring_size);
+
+	if ((result == 0) && aesd_merge_usecs)
+		result = aesd_setup_merge(dev);
+
+	// With the byte ring the mmap view maps the records where they are stored
+	if (result == 0)
+		result = aesd_mmap_view_init(&dev->view,
+				(aesd_mmap_size && dev->ring.data) ? dev->ring.size : aesd_mmap_size,
+				dev->ring.data);
+
+	if (result == 0)
+		result = aesd_setup_cdev(dev, index);
+
+	if( result ) {
+		aesd_mmap_view_exit(&dev->view);
+		free_percpu(dev->cpu_stage);
+		kvfree(dev->merge);
+		aesd_byte_ring_exit(&dev->ring);
+		kvfree(dev->buffer.entry);
+		mutex_destroy(&dev->lock);
+	}
+	return result;
+}
+
+/*
+ * Removes the cdev of @param dev and frees everything aesd_setup_dev() allocated along
+ * with the records still held.
+ */
+static void aesd_cleanup_dev(struct aesd_dev *dev)
+{
+	struct aesd_retired_batch *batch, *next;
+	struct llist_node *spare;
+
+	cdev_del(&dev->cdev);
+
+	// Records still staged per CPU are committed like any other before they are freed
+	if (dev->cpu_stage)
+	{
+		aesd_merge_staged(dev, NULL, true);
+
+		// A merge which ran before may still arm the timer once, the merge it starts finds nothing left
+		cancel_work_sync(&dev->merge_work);
+		hrtimer_cancel(&dev->merge_timer);
+		cancel_work_sync(&dev->merge_work);
+	}
+
+	PDEBUG("Just before freeing circular buffer");
+	// Held buffers take the same way back to the pool as evicted ones, in batches
+	mutex_lock(&dev->lock);
+	if (!dev->ring.data)
+		aesd_evict_oldest(dev, aesd_circular_buffer_count(&dev->buffer));
+	aesd_retire_flush(dev);
+	mutex_unlock(&dev->lock);
+	flush_work(&dev->reclaim_work);
+
+	spare = llist_del_all(&dev->spare_batches);
+	llist_for_each_entry_safe(batch, next, spare, node)
+		kfree(batch);
+
+	kvfree(dev->buffer.entry);
+	aesd_mmap_view_exit(&dev->view);
+
+	// Drop a record that never received its newline
+	aesd_pool_free(dev->temp_buffer, dev->temp_buffer_size);
+	aesd_byte_ring_exit(&dev->ring);
+	free_percpu(dev->cpu_stage);
+	kvfree(dev->merge);
+
+	// Destroy the mutex
+	mutex_destroy(&dev->lock);
+}
+
 
 int aesd_init_module(void)
 {
 	dev_t dev = 0;
+	unsigned int i;
 	int result;
-	result = alloc_chrdev_region(&dev, aesd_minor, 1,
+
+	if ((aesd_nr_devs == 0) || (aesd_nr_devs > AESDCHAR_MAX_DEVICES))
+	{
+		printk(KERN_WARNING "Can't create %u aesdchar devices\n", aesd_nr_devs);
+		return -EINVAL;
+	}
+
+	result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs,
 			"aesdchar");
 	aesd_major = MAJOR(dev);
 	if (result < 0) {
@@ -361,19 +2124,32 @@ int aesd_init_module(void)
 		return result;
 	}
 
-	memset(&aesd_device,0,sizeof(struct aesd_dev));
-
-	/**
-	 * TODO: initialize the AESD specific portion of the device
-	 */
-	aesd_circular_buffer_init(&aesd_device.buffer);  // Initializing buffer
-	mutex_init(&aesd_device.lock);  // Mutex Initialization
+	aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+	if (!aesd_devices) {
+		unregister_chrdev_region(dev, aesd_nr_devs);
+		return -ENOMEM;
+	}
 
+	result = aesd_pool_init();  // Size class caches for record buffers
+	if( result ) {
+		kfree(aesd_devices);
+		unregister_chrdev_region(dev, aesd_nr_devs);
+		return result;
+	}
 
-	result = aesd_setup_cdev(&aesd_device);
+	for (i = 0; i < aesd_nr_devs; i++)
+	{
+		result = aesd_setup_dev(&aesd_devices[i], i);
+		if (result)
+			break;
+	}
 
 	if( result ) {
-		unregister_chrdev_region(dev, 1);
+		while (i-- > 0)
+			aesd_cleanup_dev(&aesd_devices[i]);
+		aesd_pool_exit();
+		kfree(aesd_devices);
+		unregister_chrdev_region(dev, aesd_nr_devs);
 	}
 	return result;
 
@@ -383,34 +2159,17 @@ void aesd_cleanup_module(void)
 {
 	PDEBUG("Cleanup start");
 	dev_t devno = MKDEV(aesd_major, aesd_minor);
+	unsigned int i;
 
-	cdev_del(&aesd_device.cdev);
-
-	/**
-	 * TODO: cleanup AESD specific poritions here as necessary
-	 */
-
-	uint8_t i = 0;
-	struct aesd_buffer_entry *entry;
-
-	PDEBUG("Just before freeing circular buffer");
-	// Freeing memory
-	AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, i)
-	{
-		if(entry->buffptr != NULL)
-		{
-			PDEBUG("Circular Buffer Empty in Progress for Buffer: %d",i);
-			kfree(entry->buffptr);
-			entry->buffptr = NULL;
-		}
-	}
+	for (i = 0; i < aesd_nr_devs; i++)
+		aesd_cleanup_dev(&aesd_devices[i]);
 
-	// Destroy the mutex
-	mutex_destroy(&aesd_device.lock);
+	aesd_pool_exit();
+	kfree(aesd_devices);
 
-	PDEBUG("Mutex destroyed for aesd device");
+	PDEBUG("aesd devices destroyed");
 
-	unregister_chrdev_region(devno, 1);
+	unregister_chrdev_region(devno, aesd_nr_devs);
 	PDEBUG("Cleanup End");
 }
 
@@ -0,0 +1,431 @@
+/**
+ * @file    aesdbench.c
+ * @brief   Multi connection load generator and latency benchmark for aesdsocket
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Opens N connections to a running aesdsocket, over TCP or the UNIX
+ * socket, and sends records of a configurable size at a configurable rate per
+ * connection. A percentage of the operations can be AESDCHAR_IOCSEEKTO:X,Y commands
+ * into the last window records. Reports appends/s, seeks/s, replay bytes/s and
+ * p50/p99/p999 latency per operation type, as text or as one JSON line with -j.
+ *
+ * With -m shm every connection attaches to the server's shared memory ring through
+ * the UNIX socket given with -u and appends by publishing records into the ring, so
+ * the append latency is the time shm_ring_produce() takes, including any wait for
+ * the server to make room. The server sends no reply and seeks are not supported.
+ *
+ * Latency of an operation runs from sending its newline to the first byte of the
+ * server's reply. Reply bytes still queued from the previous operation are drained
+ * before the next one is sent, and every reply byte counts towards replay bytes/s.
+ * Rates are taken over the time up to the last operation of the slowest connection,
+ * connection teardown is not load.
+ *
+ * Usage: aesdbench [-h host] [-p port] [-u unix_socket] [-m tcp|shm] [-n connections]
+ *                  [-r records] [-s record_size] [-R rate] [-k seek_percent]
+ *                  [-w seek_window] [-j]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sched.h>
+#include "client_connect.h"
+#include "latency_stats.h"
+#include "shm_ring.h"
+
+#define ERROR (-1)
+#define SUCCESS (0)
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "9000"
+#define REPLY_TIMEOUT_MS (5000)
+#define RECV_BUFFER_SIZE (65536)
+#define SEEK_COMMAND_SIZE (64)
+
+/******************One connection and its results******************/
+typedef struct bench_worker
+{
+    pthread_t thread_id;
+    unsigned int id;
+    unsigned int seed;
+    latency_stats_t append_latency;
+    latency_stats_t seek_latency;
+    uint64_t appends;
+    uint64_t seeks;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t end_ns;  // When the last operation completed, 0 if none ran
+    bool failed;
+} bench_worker_t;
+
+const char *host = DEFAULT_HOST;
+const char *port = DEFAULT_PORT;
+const char *unix_path = NULL;
+bool shm_mode = false;         // Append through the shared memory ring instead of the socket
+unsigned int records_per_connection = 1000;
+size_t record_size = 64;       // Including the newline
+double rate = 0;               // Operations per second per connection, 0 is unthrottled
+unsigned int seek_percent = 0;
+unsigned int seek_window = 10; // Records a seek may target, the driver keeps 10 by default
+uint64_t bench_start_ns;
+pthread_barrier_t start_barrier;
+
+
+/* Description: Returns the monotonic clock in nanoseconds
+ */
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+/* Description: Reads whatever reply bytes are already queued without blocking
+ */
+void bench_drain(bench_worker_t *worker, int fd, char *buf)
+{
+    ssize_t bytes;
+
+    while ((bytes = recv(fd, buf, RECV_BUFFER_SIZE, MSG_DONTWAIT)) > 0)
+        worker->bytes_received += bytes;
+}
+
+/* Description: Ends the sending side of @param fd and reads the rest of the replies
+ * until the server closes the connection, waiting at most REPLY_TIMEOUT_MS for each
+ * read so a server which keeps the connection open cannot hang the benchmark.
+ * Returns the number of bytes read.
+ */
+uint64_t bench_finish(int fd, char *buf, size_t size)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    uint64_t received = 0;
+    ssize_t bytes;
+
+    shutdown(fd, SHUT_WR);
+    while ((poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0) && ((bytes = recv(fd, buf, size, 0)) > 0))
+        received += bytes;
+    return received;
+}
+
+/* Description: Sends one newline terminated operation and waits for the first reply
+ * byte. Returns the latency in nanoseconds or 0 on failure.
+ */
+uint64_t bench_operation(bench_worker_t *worker, int fd, const char *op, size_t length, char *buf)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    size_t sent = 0;
+    uint64_t start_ns;
+    ssize_t bytes;
+
+    bench_drain(worker, fd, buf);
+
+    start_ns = now_ns();
+    while (sent < length)
+    {
+        bytes = send(fd, op + sent, length - sent, MSG_NOSIGNAL);
+        if (bytes == ERROR)
+            return 0;
+        sent += bytes;
+    }
+    worker->bytes_sent += sent;
+
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0)
+        return 0;
+
+    bytes = recv(fd, buf, RECV_BUFFER_SIZE, 0);
+    if (bytes <= 0)
+        return 0;
+    worker->bytes_received += bytes;
+
+    return now_ns() - start_ns;
+}
+
+/* Description: Publishes one record into the shared memory @param ring, retrying for
+ * at most REPLY_TIMEOUT_MS while the ring is full. Returns the latency in nanoseconds
+ * or 0 on failure.
+ */
+uint64_t bench_produce(bench_worker_t *worker, shm_ring_t *ring, const char *record, size_t length)
+{
+    uint64_t start_ns = now_ns();
+    uint64_t end_ns;
+
+    while (shm_ring_produce(ring, record, length) == ERROR)
+    {
+        if ((errno != EAGAIN) || ((now_ns() - start_ns) > (REPLY_TIMEOUT_MS * 1000000ull)))
+            return 0;
+        sched_yield();
+    }
+    end_ns = now_ns();
+    worker->bytes_sent += length;
+
+    // Never report 0, which means failure
+    return (end_ns > start_ns) ? (end_ns - start_ns) : 1;
+}
+
+/* Description: Thread driving one connection
+ */
+void *bench_worker_thread(void *thread_data)
+{
+    bench_worker_t *worker = (bench_worker_t *) thread_data;
+    char *record = malloc(record_size);
+    char *buf = malloc(RECV_BUFFER_SIZE);
+    char seek[SEEK_COMMAND_SIZE];
+    shm_ring_t ring = { .memfd = ERROR, .eventfd = ERROR };
+    int fd = ERROR;
+    bool connected;
+    unsigned int i;
+
+    if (shm_mode)
+        connected = (shm_ring_connect(&ring, unix_path) == SUCCESS);
+    else
+        connected = ((fd = client_connect(host, port, unix_path)) != ERROR);
+
+    pthread_barrier_wait(&start_barrier);
+
+    if ((record == NULL) || (buf == NULL) || !connected)
+    {
+        perror("Benchmark worker setup");
+        worker->failed = true;
+        goto exit;
+    }
+
+    // Printable payload which identifies the connection
+    memset(record, 'a' + (worker->id % 26), record_size - 1);
+    record[record_size - 1] = '\n';
+
+    for (i = 0; i < records_per_connection; i++)
+    {
+        bool do_seek = (seek_percent > 0) && ((unsigned int) (rand_r(&worker->seed) % 100) < seek_percent);
+        uint64_t latency;
+
+        if (rate > 0)
+        {
+            uint64_t due_ns = bench_start_ns + (uint64_t) ((i * 1e9) / rate);
+            struct timespec due = { .tv_sec = due_ns / 1000000000ull, .tv_nsec = due_ns % 1000000000ull };
+
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+                ;
+        }
+
+        if (do_seek)
+        {
+            int length = snprintf(seek, sizeof(seek), "AESDCHAR_IOCSEEKTO:%u,%u\n",
+                    rand_r(&worker->seed) % seek_window, 0);
+
+            latency = bench_operation(worker, fd, seek, length, buf);
+            if ((latency == 0) || (latency_stats_add(&worker->seek_latency, latency) != SUCCESS))
+            {
+                worker->failed = true;
+                break;
+            }
+            worker->seeks++;
+        }
+        else
+        {
+            if (shm_mode)
+                latency = bench_produce(worker, &ring, record, record_size);
+            else
+                latency = bench_operation(worker, fd, record, record_size, buf);
+            if ((latency == 0) || (latency_stats_add(&worker->append_latency, latency) != SUCCESS))
+            {
+                worker->failed = true;
+                break;
+            }
+            worker->appends++;
+        }
+    }
+
+    // Rates cover the operations only, not the teardown of the connection
+    worker->end_ns = now_ns();
+
+    if (fd != ERROR)
+    {
+        worker->bytes_received += bench_finish(fd, buf, RECV_BUFFER_SIZE);
+        close(fd);
+    }
+
+exit:
+    shm_ring_close(&ring);
+    free(record);
+    free(buf);
+    return worker;
+}
+
+/* Description: Appends seek_window records so that every seek target exists
+ */
+int bench_prefill(void)
+{
+    char record[] = "aesdbench prefill\n";
+    char buf[RECV_BUFFER_SIZE];
+    unsigned int i;
+    int fd;
+
+    for (i = 0; i < seek_window; i++)
+    {
+        fd = client_connect(host, port, unix_path);
+        if (fd == ERROR)
+            return ERROR;
+
+        if (send(fd, record, strlen(record), MSG_NOSIGNAL) == ERROR)
+        {
+            close(fd);
+            return ERROR;
+        }
+        bench_finish(fd, buf, sizeof(buf));
+        close(fd);
+    }
+    return SUCCESS;
+}
+
+/* Description: Prints the usage of the benchmark
+ */
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-u unix_socket] [-m tcp|shm] [-n connections]\n"
+                    "       [-r records] [-s record_size] [-R rate] [-k seek_percent] [-w seek_window] [-j]\n"
+                    "       -m shm needs -u and does not support seeks\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_worker_t *workers;
+    latency_stats_t append_latency, seek_latency;
+    unsigned int connections = 4;
+    bool json = false;
+    int option;
+    unsigned int i;
+    uint64_t appends = 0, seeks = 0, bytes_sent = 0, bytes_received = 0, failures = 0;
+    uint64_t end_ns = 0;
+    const char *transport;
+    const char *mode = "tcp";
+
+    while ((option = getopt(argc, argv, "h:p:u:m:n:r:s:R:k:w:j")) != ERROR)
+    {
+        switch (option)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = optarg; break;
+            case 'u': unix_path = optarg; break;
+            case 'm': mode = optarg; break;
+            case 'n': connections = atoi(optarg); break;
+            case 'r': records_per_connection = atoi(optarg); break;
+            case 's': record_size = atoi(optarg); break;
+            case 'R': rate = atof(optarg); break;
+            case 'k': seek_percent = atoi(optarg); break;
+            case 'w': seek_window = atoi(optarg); break;
+            case 'j': json = true; break;
+            default:
+                usage(argv[0]);
+                return ERROR;
+        }
+    }
+
+    shm_mode = (strcmp(mode, "shm") == 0);
+
+    if ((optind != argc) || (connections == 0) || (record_size == 0) || (seek_percent > 100) ||
+        (seek_window == 0) || (rate < 0) || (!shm_mode && (strcmp(mode, "tcp") != 0)) ||
+        (shm_mode && ((unix_path == NULL) || (seek_percent > 0))))
+    {
+        usage(argv[0]);
+        return ERROR;
+    }
+    transport = shm_mode ? "shm" : ((unix_path != NULL) ? "unix" : "tcp");
+
+    if ((seek_percent > 0) && (bench_prefill() == ERROR))
+    {
+        perror("Benchmark prefill");
+        return ERROR;
+    }
+
+    workers = calloc(connections, sizeof(bench_worker_t));
+    if ((workers == NULL) || (pthread_barrier_init(&start_barrier, NULL, connections + 1) != SUCCESS))
+    {
+        perror("Benchmark setup");
+        return ERROR;
+    }
+
+    for (i = 0; i < connections; i++)
+    {
+        workers[i].id = i;
+        workers[i].seed = i + 1;
+        latency_stats_init(&workers[i].append_latency);
+        latency_stats_init(&workers[i].seek_latency);
+        if (pthread_create(&workers[i].thread_id, NULL, bench_worker_thread, &workers[i]) != SUCCESS)
+        {
+            perror("pthread_create() for benchmark worker");
+            return ERROR;
+        }
+    }
+
+    bench_start_ns = now_ns();
+    pthread_barrier_wait(&start_barrier);
+
+    latency_stats_init(&append_latency);
+    latency_stats_init(&seek_latency);
+    for (i = 0; i < connections; i++)
+    {
+        pthread_join(workers[i].thread_id, NULL);
+        appends += workers[i].appends;
+        seeks += workers[i].seeks;
+        bytes_sent += workers[i].bytes_sent;
+        bytes_received += workers[i].bytes_received;
+        failures += workers[i].failed;
+        if (workers[i].end_ns > end_ns)
+            end_ns = workers[i].end_ns;
+        latency_stats_merge(&append_latency, &workers[i].append_latency);
+        latency_stats_merge(&seek_latency, &workers[i].seek_latency);
+        latency_stats_free(&workers[i].append_latency);
+        latency_stats_free(&workers[i].seek_latency);
+    }
+
+    // Up to the last operation of the slowest connection
+    double elapsed = (((end_ns > bench_start_ns) ? end_ns : now_ns()) - bench_start_ns) / 1e9;
+
+    latency_stats_finish(&append_latency);
+    latency_stats_finish(&seek_latency);
+
+    if (json)
+    {
+        printf("{\"tool\":\"aesdbench\",\"transport\":\"%s\",\"connections\":%u,\"failed_connections\":%llu,"
+               "\"record_size\":%zu,\"rate\":%g,\"seek_percent\":%u,\"elapsed_s\":%.6f,"
+               "\"appends\":%llu,\"appends_per_s\":%.1f,\"seeks\":%llu,\"seeks_per_s\":%.1f,"
+               "\"bytes_sent\":%llu,\"replay_bytes\":%llu,\"replay_bytes_per_s\":%.1f,\"append_latency\":",
+               transport, connections, (unsigned long long) failures,
+               record_size, rate, seek_percent, elapsed,
+               (unsigned long long) appends, appends / elapsed, (unsigned long long) seeks, seeks / elapsed,
+               (unsigned long long) bytes_sent, (unsigned long long) bytes_received, bytes_received / elapsed);
+        latency_stats_print_json(&append_latency, stdout);
+        printf(",\"seek_latency\":");
+        latency_stats_print_json(&seek_latency, stdout);
+        printf("}\n");
+    }
+    else
+    {
+        printf("transport=%s connections=%u failed=%llu record_size=%zu elapsed_s=%.3f\n",
+               transport, connections, (unsigned long long) failures,
+               record_size, elapsed);
+        printf("appends=%llu appends_per_s=%.1f seeks=%llu seeks_per_s=%.1f replay_MB_per_s=%.2f\n",
+               (unsigned long long) appends, appends / elapsed, (unsigned long long) seeks, seeks / elapsed,
+               bytes_received / elapsed / 1e6);
+        printf("append ");
+        latency_stats_print(&append_latency, stdout);
+        printf("seek   ");
+        latency_stats_print(&seek_latency, stdout);
+    }
+
+    latency_stats_free(&append_latency);
+    latency_stats_free(&seek_latency);
+    free(workers);
+    pthread_barrier_destroy(&start_barrier);
+
+    return (failures == 0) ? SUCCESS : ERROR;
+}
@@ -0,0 +1,401 @@
+/**
+ * @file    aesdreplay.c
+ * @brief   Replays an aesdsocket traffic capture against a running server
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Reads a capture written by "aesdsocket -r <file>" and re-drives every
+ * captured connection on its own thread, keeping the captured timing scaled by the
+ * speed factor, or as fast as possible with speed 0. The capture can be fanned out
+ * into several copies to multiply the load. Latency is measured from the moment a
+ * newline terminated record was sent to the first byte of the server's reply.
+ *
+ * Usage: aesdreplay [-h host] [-p port] [-u unix_socket] [-s speed] [-m copies] [-j] capture_file
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "capture.h"
+#include "client_connect.h"
+#include "latency_stats.h"
+
+#define ERROR (-1)
+#define SUCCESS (0)
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "9000"
+#define REPLY_TIMEOUT_MS (5000)
+#define RECV_BUFFER_SIZE (65536)
+
+/******************All captured events of one connection******************/
+typedef struct replay_connection
+{
+    uint32_t connection_id;
+    capture_event_t *events;
+    size_t count;
+    size_t capacity;
+} replay_connection_t;
+
+/******************One replaying thread and its results******************/
+typedef struct replay_worker
+{
+    pthread_t thread_id;
+    const replay_connection_t *connection;
+    latency_stats_t latency;
+    uint64_t records_sent;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t end_ns;  // When the last event was replayed, 0 if none was
+    bool failed;
+} replay_worker_t;
+
+const char *host = DEFAULT_HOST;
+const char *port = DEFAULT_PORT;
+const char *unix_path = NULL;
+double speed = 1.0;  // 0 replays as fast as possible
+uint64_t replay_start_ns;
+pthread_barrier_t start_barrier;
+
+
+/* Description: Reads whatever reply bytes are already queued without blocking
+ */
+void replay_drain(replay_worker_t *worker, int fd, char *buf)
+{
+    ssize_t bytes;
+
+    while ((bytes = recv(fd, buf, RECV_BUFFER_SIZE, MSG_DONTWAIT)) > 0)
+        worker->bytes_received += bytes;
+}
+
+/* Description: Closes the sending side and reads the rest of the reply until the
+ * server closes the connection, waiting at most REPLY_TIMEOUT_MS for each read so a
+ * server which keeps the connection open cannot hang the replay
+ */
+void replay_finish(replay_worker_t *worker, int fd, char *buf)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    ssize_t bytes;
+
+    shutdown(fd, SHUT_WR);
+    while ((poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0) && ((bytes = recv(fd, buf, RECV_BUFFER_SIZE, 0)) > 0))
+        worker->bytes_received += bytes;
+    close(fd);
+}
+
+/* Description: Sends one captured payload and, if it completes a record, waits for
+ * the first byte of the reply to take a latency sample. Returns 0 or -1 on failure.
+ */
+int replay_send(replay_worker_t *worker, int fd, const capture_event_t *event, char *buf)
+{
+    size_t sent = 0;
+    const char *scan;
+    uint64_t records = 0;
+
+    replay_drain(worker, fd, buf);  // Earlier replies must not count as this one
+
+    while (sent < event->header.length)
+    {
+        ssize_t bytes = send(fd, event->data + sent, event->header.length - sent, MSG_NOSIGNAL);
+
+        if (bytes == ERROR)
+            return ERROR;
+        sent += bytes;
+    }
+    worker->bytes_sent += sent;
+
+    for (scan = event->data; (scan = memchr(scan, '\n', (event->data + sent) - scan)) != NULL; scan++)
+        records++;
+
+    if (records == 0)
+        return SUCCESS;
+    worker->records_sent += records;
+
+    uint64_t sent_ns = capture_now_ns();
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0)
+        return ERROR;
+
+    ssize_t bytes = recv(fd, buf, RECV_BUFFER_SIZE, 0);
+
+    if (bytes <= 0)
+        return ERROR;
+    worker->bytes_received += bytes;
+
+    return latency_stats_add(&worker->latency, capture_now_ns() - sent_ns);
+}
+
+/* Description: Thread replaying the events of one captured connection
+ */
+void *replay_worker_thread(void *thread_data)
+{
+    replay_worker_t *worker = (replay_worker_t *) thread_data;
+    const replay_connection_t *connection = worker->connection;
+    char *buf = malloc(RECV_BUFFER_SIZE);
+    int fd = ERROR;
+    size_t i;
+
+    pthread_barrier_wait(&start_barrier);
+
+    if (buf == NULL)
+    {
+        worker->failed = true;
+        return worker;
+    }
+
+    for (i = 0; (i < connection->count) && !worker->failed; i++)
+    {
+        const capture_event_t *event = &connection->events[i];
+
+        if (speed > 0)
+        {
+            uint64_t due_ns = replay_start_ns + (uint64_t) (event->header.timestamp_ns / speed);
+            struct timespec due = { .tv_sec = due_ns / 1000000000ull, .tv_nsec = due_ns % 1000000000ull };
+
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+                ;
+        }
+
+        if ((fd == ERROR) && (event->header.type != CAPTURE_EVENT_CLOSE))
+        {
+            fd = client_connect(host, port, unix_path);
+            if (fd == ERROR)
+            {
+                perror("Replay connect");
+                worker->failed = true;
+                break;
+            }
+        }
+
+        switch (event->header.type)
+        {
+            case CAPTURE_EVENT_DATA:
+                if (replay_send(worker, fd, event, buf) == ERROR)
+                {
+                    perror("Replay send");
+                    worker->failed = true;
+                }
+                worker->end_ns = capture_now_ns();
+                break;
+
+            case CAPTURE_EVENT_CLOSE:
+                // Waiting for the server to close is not part of the replayed load
+                worker->end_ns = capture_now_ns();
+                if (fd != ERROR)
+                    replay_finish(worker, fd, buf);
+                fd = ERROR;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (fd != ERROR)
+        replay_finish(worker, fd, buf);
+
+    free(buf);
+    return worker;
+}
+
+/* Description: Reads the whole capture and groups its events per connection.
+ * Returns the number of connections or -1 on failure.
+ */
+ssize_t replay_load(const char *path, replay_connection_t **connections_rtn)
+{
+    struct capture_file_header header;
+    FILE *file = capture_read_open(path, &header);
+    replay_connection_t *connections = NULL;
+    size_t connection_count = 0;
+    capture_event_t event;
+    int status;
+
+    if (file == NULL)
+    {
+        perror("Capture open");
+        return ERROR;
+    }
+
+    while ((status = capture_read_event(file, &event)) == 1)
+    {
+        replay_connection_t *connection = NULL;
+        size_t i;
+
+        for (i = 0; i < connection_count; i++)
+        {
+            if (connections[i].connection_id == event.header.connection_id)
+            {
+                connection = &connections[i];
+                break;
+            }
+        }
+
+        if (connection == NULL)
+        {
+            replay_connection_t *grown = realloc(connections, (connection_count + 1) * sizeof(replay_connection_t));
+
+            if (grown == NULL)
+            {
+                status = ERROR;
+                break;
+            }
+            connections = grown;
+            connection = &connections[connection_count++];
+            memset(connection, 0, sizeof(replay_connection_t));
+            connection->connection_id = event.header.connection_id;
+        }
+
+        if (connection->count == connection->capacity)
+        {
+            size_t capacity = connection->capacity ? (connection->capacity * 2) : 64;
+            capture_event_t *grown = realloc(connection->events, capacity * sizeof(capture_event_t));
+
+            if (grown == NULL)
+            {
+                status = ERROR;
+                break;
+            }
+            connection->events = grown;
+            connection->capacity = capacity;
+        }
+        connection->events[connection->count++] = event;
+    }
+
+    fclose(file);
+
+    if (status == ERROR)
+    {
+        fprintf(stderr, "Capture %s is unreadable\n", path);
+        return ERROR;
+    }
+
+    *connections_rtn = connections;
+    return connection_count;
+}
+
+int main(int argc, char *argv[])
+{
+    replay_connection_t *connections = NULL;
+    replay_worker_t *workers;
+    latency_stats_t latency;
+    ssize_t connection_count;
+    int copies = 1;
+    bool json = false;
+    int option;
+    size_t i, worker_count;
+    uint64_t records = 0, bytes_sent = 0, bytes_received = 0, failures = 0;
+    uint64_t end_ns = 0;
+
+    while ((option = getopt(argc, argv, "h:p:u:s:m:j")) != ERROR)
+    {
+        switch (option)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = optarg; break;
+            case 'u': unix_path = optarg; break;
+            case 's': speed = atof(optarg); break;
+            case 'm': copies = atoi(optarg); break;
+            case 'j': json = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-h host] [-p port] [-u unix_socket] [-s speed] [-m copies] [-j] capture_file\n",
+                        argv[0]);
+                return ERROR;
+        }
+    }
+
+    if ((optind != (argc - 1)) || (copies < 1) || (speed < 0))
+    {
+        fprintf(stderr, "Usage: %s [-h host] [-p port] [-u unix_socket] [-s speed] [-m copies] [-j] capture_file\n",
+                argv[0]);
+        return ERROR;
+    }
+
+    connection_count = replay_load(argv[optind], &connections);
+    if (connection_count <= 0)
+        return ERROR;
+
+    worker_count = (size_t) connection_count * copies;
+    workers = calloc(worker_count, sizeof(replay_worker_t));
+    if ((workers == NULL) || (pthread_barrier_init(&start_barrier, NULL, worker_count + 1) != SUCCESS))
+    {
+        perror("Replay setup");
+        return ERROR;
+    }
+
+    for (i = 0; i < worker_count; i++)
+    {
+        workers[i].connection = &connections[i % connection_count];
+        latency_stats_init(&workers[i].latency);
+        if (pthread_create(&workers[i].thread_id, NULL, replay_worker_thread, &workers[i]) != SUCCESS)
+        {
+            perror("pthread_create() for replay worker");
+            return ERROR;
+        }
+    }
+
+    // Every worker shares the same time origin
+    replay_start_ns = capture_now_ns();
+    pthread_barrier_wait(&start_barrier);
+
+    latency_stats_init(&latency);
+    for (i = 0; i < worker_count; i++)
+    {
+        pthread_join(workers[i].thread_id, NULL);
+        records += workers[i].records_sent;
+        bytes_sent += workers[i].bytes_sent;
+        bytes_received += workers[i].bytes_received;
+        failures += workers[i].failed;
+        if (workers[i].end_ns > end_ns)
+            end_ns = workers[i].end_ns;
+        latency_stats_merge(&latency, &workers[i].latency);
+        latency_stats_free(&workers[i].latency);
+    }
+
+    // Up to the last replayed event of any connection
+    double elapsed = (((end_ns > replay_start_ns) ? end_ns : capture_now_ns()) - replay_start_ns) / 1e9;
+
+    latency_stats_finish(&latency);
+
+    if (json)
+    {
+        printf("{\"tool\":\"aesdreplay\",\"speed\":%g,\"connections\":%zu,\"failed_connections\":%llu,"
+               "\"elapsed_s\":%.6f,\"records\":%llu,\"records_per_s\":%.1f,\"bytes_sent\":%llu,"
+               "\"bytes_received\":%llu,\"received_bytes_per_s\":%.1f,\"latency\":",
+               speed, worker_count, (unsigned long long) failures, elapsed, (unsigned long long) records,
+               records / elapsed, (unsigned long long) bytes_sent, (unsigned long long) bytes_received,
+               bytes_received / elapsed);
+        latency_stats_print_json(&latency, stdout);
+        printf("}\n");
+    }
+    else
+    {
+        printf("connections=%zu failed=%llu elapsed_s=%.3f\n", worker_count, (unsigned long long) failures, elapsed);
+        printf("records=%llu records_per_s=%.1f sent_MB_per_s=%.2f received_MB_per_s=%.2f\n",
+               (unsigned long long) records, records / elapsed, bytes_sent / elapsed / 1e6,
+               bytes_received / elapsed / 1e6);
+        latency_stats_print(&latency, stdout);
+    }
+
+    latency_stats_free(&latency);
+    for (i = 0; i < (size_t) connection_count; i++)
+    {
+        size_t j;
+
+        for (j = 0; j < connections[i].count; j++)
+            free(connections[i].events[j].data);
+        free(connections[i].events);
+    }
+    free(connections);
+    free(workers);
+    pthread_barrier_destroy(&start_barrier);
+
+    return (failures == 0) ? SUCCESS : ERROR;
+}
@@ -37,7 +37,13 @@
 #include <pthread.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <poll.h>
 #include "queue.h"
+#include "record_index.h"
+#include "shm_ring.h"
+#include "capture.h"
 #include "../aesd-char-driver/aesd_ioctl.h"
 
 /*****************************************DEFINES***********************************/
@@ -46,21 +52,33 @@
 #define SUCCESS (0)
 #define BACKLOG (10)  // Number of pending connection queue will hold
 #define MAX_BUFFER_SIZE 1024
+#define SENDFILE_CHUNK_SIZE (1 << 20)  // Bytes asked of the driver per sendfile call
 #define TIME_STAMP_INTERVAL_IN_SECS (10)
+#define UNIX_SOCKET_PATH "/var/tmp/aesdsocket.sock"  // Local clients and shared ring attach
+#define SHM_RING_WAIT_MS (1000)  // Bounds how long the drainer takes to notice exit
 
 
-// Used as a build switch for device driver
-#define USE_AESD_CHAR_DEVICE
+// Used as a build switch for device driver, build with USE_AESD_CHAR_DEVICE=0 for file mode
+#ifndef USE_AESD_CHAR_DEVICE
+#define USE_AESD_CHAR_DEVICE 1
+#endif
 
 // Using buildswitch for character device driver
-#ifdef USE_AESD_CHAR_DEVICE
+#if USE_AESD_CHAR_DEVICE
 #define DATA_PATH "/dev/aesdchar"
+#define OPTIONS "dr:"
+#define USAGE "Usage: %s [-d] [-r capture_file]\n"
 #else
 #define DATA_PATH "/var/tmp/aesdsocketdata"
+#define OPTIONS "dr:i:c"  // The record index only exists in file mode
+#define USAGE "Usage: %s [-d] [-r capture_file] [-i record_index_file] [-c]\n"
 #endif
 
 
 int server_fd, client_fd;  // File descriptors for server and client
+int unix_fd = ERROR;  // Listening UNIX socket for same host clients
+shm_ring_t shm_ring = { .memfd = ERROR, .eventfd = ERROR };  // Handed to same host producers
+capture_writer_t capture_writer = CAPTURE_WRITER_INITIALIZER;  // Inbound traffic capture, enabled with -r
 int file_fd;  // Files descriptor for the data file
 bool daemon_flag = false;
 volatile sig_atomic_t exit_flag = 0;
@@ -71,11 +89,13 @@ typedef struct client_node
     pthread_t thread_id;
     int connection_fd;
     bool thread_completion_status;
+    bool local_connection;  // Accepted on the UNIX socket, may attach to the shared ring
+    uint32_t connection_id;  // Identifies the connection in a traffic capture
     pthread_mutex_t *thread_mutex;
     SLIST_ENTRY(client_node) next_node;  // Pointer to next elemenet
 } client_node_t;
 
-#ifndef USE_AESD_CHAR_DEVICE
+#if !USE_AESD_CHAR_DEVICE
 // Struct for timestamp thread
 typedef struct timestamp
 {
@@ -85,6 +105,11 @@ typedef struct timestamp
 
 
 timestamp_t *time_node = NULL;
+
+// Record number to file offset index used to honour AESDCHAR_IOCSEEKTO in file mode
+record_index_t record_index;
+const char *record_index_path = NULL;  // Set with -i to persist the index
+bool record_checksums = false;  // Set with -c to protect every record with a CRC-32C
 #endif
 
 
@@ -101,6 +126,15 @@ void cleanup(void)
         syslog(LOG_ERR, "Server fd close");
     }
 
+    if (close(unix_fd) == ERROR) 
+    {
+        perror("Unix fd");
+        syslog(LOG_ERR, "Unix fd close");
+    }
+    unlink(UNIX_SOCKET_PATH);
+    shm_ring_close(&shm_ring);
+    capture_close(&capture_writer);
+
     // Error handling for closing fd
     if (close(file_fd) == ERROR) 
     {
@@ -109,13 +143,21 @@ void cleanup(void)
     }
 
     // Do not remove the driver
-#ifndef USE_AESD_CHAR_DEVICE
+#if !USE_AESD_CHAR_DEVICE
     // Error handling for deleting file
     if(remove(DATA_PATH) == ERROR)
     {
         perror("File removal");
         syslog(LOG_ERR, " File removal failed");
     }
+
+    // The persisted index describes the removed file, so it goes too
+    record_index_free(&record_index);
+    if((record_index_path != NULL) && (remove(record_index_path) == ERROR))
+    {
+        perror("Record index removal");
+        syslog(LOG_ERR, "Record index removal failed");
+    }
 #endif
 
     syslog(LOG_DEBUG, "Cleanup End");
@@ -220,7 +262,11 @@ void signal_handler(int signo)
 
         close(server_fd);
 
-#ifndef USE_AESD_CHAR_DEVICE
+        shutdown(unix_fd, SHUT_RDWR);
+
+        shm_ring_wake(&shm_ring);  // Let the drainer notice the exit flag
+
+#if !USE_AESD_CHAR_DEVICE
         pthread_cancel(time_node -> thread_id);
 #endif
     }
@@ -238,7 +284,7 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6 *) sa)->sin6_addr);
 }
 
-#ifndef USE_AESD_CHAR_DEVICE
+#if !USE_AESD_CHAR_DEVICE
 // Function to append a timestamp to the file
 void  *timestamp_appender(void *thread_node) 
 {
@@ -289,9 +335,15 @@ void  *timestamp_appender(void *thread_node)
         {
             perror("Timestamp file write");
             syslog(LOG_ERR, "Timestamp file write");
+            pthread_mutex_unlock(timestamp_data -> thread_mutex);
             return NULL;
         }
 
+        if(record_index_append(&record_index, timestamp, strlen(timestamp)) == ERROR)
+        {
+            syslog(LOG_ERR, "Timestamp record index update");
+        }
+
         if(pthread_mutex_unlock(timestamp_data -> thread_mutex) != SUCCESS)
         {
             perror("Mutex Unlock");
@@ -303,6 +355,174 @@ void  *timestamp_appender(void *thread_node)
 #endif
 
 
+/* Description: Appends length bytes from buf to the data store. This is the commit
+ * path shared by socket clients and the shared memory ring drainer, the caller must
+ * hold the data mutex.
+ */
+int store_append(const char *buf, size_t length)
+{
+    size_t written = 0;
+    int fd = open(DATA_PATH, O_CREAT | O_RDWR | O_APPEND, 0666);
+
+    if (fd == ERROR) 
+    {
+        perror("File open error");
+        syslog(LOG_ERR, "File Open error");
+        return ERROR;
+    }
+
+    // The driver commits one record per write, keep writing until everything is stored
+    while (written < length)
+    {
+        ssize_t bytes_written = write(fd, buf + written, length - written);
+
+        if (bytes_written == ERROR) 
+        {
+            perror("File write error");
+            syslog(LOG_ERR, "File write error");
+            close(fd);
+            return ERROR;
+        }
+        written += bytes_written;
+    }
+
+#if !USE_AESD_CHAR_DEVICE
+    if (record_index_append(&record_index, buf, length) == ERROR)
+    {
+        syslog(LOG_ERR, "Record index update failed");
+    }
+#endif
+
+    close(fd);
+    return SUCCESS;
+}
+
+
+/* Description: Abandons the shared ring once a producer corrupted it or died holding a
+ * slot, and creates a new one for the producers which attach from now on. Attaching is
+ * done under the mutex, so no producer is handed the old ring meanwhile.
+ * Return: SUCCESS, or ERROR if no new ring could be created
+ */
+static int shm_ring_replace(pthread_mutex_t *mutex)
+{
+    int status = SUCCESS;
+
+    syslog(LOG_ERR, "Shared ring unusable (%s), replacing it", strerror(errno));
+
+    if (pthread_mutex_lock(mutex) != SUCCESS)
+    {
+        perror("Mutex lock failure");
+        syslog(LOG_ERR, "Mutex lock failure");
+        return ERROR;
+    }
+
+    shm_ring_abandon(&shm_ring);
+    if (shm_ring_create(&shm_ring, SHM_RING_DEFAULT_SIZE) == ERROR)
+    {
+        syslog(LOG_ERR, "Shared ring creation");
+        status = ERROR;
+    }
+
+    pthread_mutex_unlock(mutex);
+    return status;
+}
+
+/* Description: This thread drains records published by same host producers through
+ * the shared memory ring and commits them through store_append(), batching every
+ * record which is already committed into a single write.
+ */
+void *shm_ring_drainer(void *thread_mutex)
+{
+    pthread_mutex_t *mutex = (pthread_mutex_t *) thread_mutex;
+    size_t records_size = shm_ring_max_record(&shm_ring);
+    char *records = malloc(records_size);
+
+    if (records == NULL)
+    {
+        perror("Malloc for shared ring drainer");
+        syslog(LOG_ERR, "Malloc for shared ring drainer");
+        return NULL;
+    }
+
+    while (1)
+    {
+        ssize_t length = shm_ring_consume(&shm_ring, records, records_size);
+
+        if (length == ERROR)
+        {
+            if (shm_ring_replace(mutex) != SUCCESS)
+                break;
+            continue;
+        }
+
+        if (length == 0)
+        {
+            if (exit_flag)
+                break;
+
+            // Idle at least every SHM_RING_WAIT_MS, which bounds how stale the capture file gets
+            capture_flush(&capture_writer);
+            shm_ring_wait(&shm_ring, SHM_RING_WAIT_MS);
+            continue;
+        }
+
+        if (pthread_mutex_lock(mutex) != SUCCESS)
+        {
+            perror("Mutex lock failure");
+            syslog(LOG_ERR, "Mutex lock failure");
+            break;
+        }
+
+        capture_event(&capture_writer, 0, CAPTURE_EVENT_DATA, records, length);
+        store_append(records, length);
+
+        if (pthread_mutex_unlock(mutex) != SUCCESS)
+        {
+            perror("Mutex unlock failure");
+            syslog(LOG_ERR, "Mutex unlock failure");
+            break;
+        }
+    }
+
+    free(records);
+    return NULL;
+}
+
+
+#if USE_AESD_CHAR_DEVICE
+/* Description: Sends the records of the char device from the position of file_fd to
+ * the client. sendfile() splices them through the kernel without a user buffer, a
+ * driver without splice support falls back to read and send.
+ * Return: SUCCESS, or ERROR if reading or sending failed
+ */
+int send_device_records(int file_fd, int socket_fd)
+{
+    char buf[MAX_BUFFER_SIZE];
+    ssize_t bytes_sent;
+
+    while ((bytes_sent = sendfile(socket_fd, file_fd, NULL, SENDFILE_CHUNK_SIZE)) > 0)
+        ;
+
+    if (bytes_sent == 0)
+        return SUCCESS;
+    if ((errno != EINVAL) && (errno != ENOSYS))
+        return ERROR;
+
+    while (1)
+    {
+        ssize_t bytes_read = read(file_fd, buf, MAX_BUFFER_SIZE);
+
+        if (bytes_read == ERROR)
+            return ERROR;
+        if (bytes_read == 0)
+            return SUCCESS;
+        if (send(socket_fd, buf, bytes_read, 0) == ERROR)
+            return ERROR;
+    }
+}
+#endif
+
+
 /* Description: This function handles the client connections in a thread
 */
 void *client_handler(void *client_thread) 
@@ -316,13 +536,17 @@ void *client_handler(void *client_thread)
 
     char buf[MAX_BUFFER_SIZE];
     int bytes_received = 0;
-    int file_fd;
+    int file_fd = ERROR;
     bool newline_status = false;
     bool ioctl_recv = false;
     char *ioctl_string;
+#if !USE_AESD_CHAR_DEVICE
+    off_t read_offset = 0;  // Position of the next positional read in file mode
+#endif
 
     client_node_t *node = (client_node_t *) client_thread;
     node->thread_completion_status = false;
+    capture_event(&capture_writer, node->connection_id, CAPTURE_EVENT_OPEN, NULL, 0);
 
     ioctl_string = "AESDCHAR_IOCSEEKTO:"; // Ioctl setup
     memset(buf, '\0', MAX_BUFFER_SIZE);           // Clear the buffer
@@ -345,6 +569,8 @@ void *client_handler(void *client_thread)
             break;
         }
 
+        capture_event(&capture_writer, node->connection_id, CAPTURE_EVENT_DATA, buf, bytes_received);
+
         // Lock the mutex before writing to the file
         if (pthread_mutex_lock(node->thread_mutex) != SUCCESS) 
 	{
@@ -357,6 +583,17 @@ void *client_handler(void *client_thread)
         if ((memchr(buf, '\n', bytes_received)) != NULL)
             newline_status = true;
 
+        // Same host producers ask for the shared ring instead of sending records
+        if (node->local_connection && (newline_status == true) &&
+            (strncmp(buf, SHM_RING_ATTACH_STRING, strlen(SHM_RING_ATTACH_STRING)) == 0))
+        {
+            // Under the mutex, the drainer may be replacing the ring
+            if (shm_ring_send_fds(&shm_ring, node->connection_fd) == SUCCESS)
+                syslog(LOG_INFO, "Shared ring handed to local producer");
+            pthread_mutex_unlock(node->thread_mutex);
+            break;
+        }
+
         if (newline_status == true) 
 	{
 		// Check if ioctl was received
@@ -369,6 +606,7 @@ void *client_handler(void *client_thread)
                 
 		struct aesd_seekto seekto;
                 sscanf(buf, "AESDCHAR_IOCSEEKTO:%d,%d", &seekto.write_cmd, &seekto.write_cmd_offset);
+#if USE_AESD_CHAR_DEVICE
                 // Append after opening and do not close the file descriptor to honour the seek from ioctl
 		file_fd = open(DATA_PATH, O_RDWR, 0666);
                 if (file_fd == ERROR) 
@@ -387,30 +625,44 @@ void *client_handler(void *client_thread)
                     syslog(LOG_ERR, "ioctl write command");
                     goto exit;
                 }
-            } 
-	    else 
-	    {
-                file_fd = open(DATA_PATH, O_CREAT | O_RDWR | O_APPEND,0666);
-                if (file_fd == ERROR) 
-		{
-                    perror("File open error");
-                    syslog(LOG_ERR, "File Open error");
-                } 
-		else 
+#else
+                // Resolve the seek from the record index, the read loop then uses pread
+                if (record_index_lookup(&record_index, seekto.write_cmd, seekto.write_cmd_offset, &read_offset) == ERROR)
 		{
-                    syslog(LOG_INFO, "Opened aesdchar driver successfully");
+                    perror("Record index seek");
+                    syslog(LOG_ERR, "Record index seek out of range");
+                    pthread_mutex_unlock(node->thread_mutex);
+                    goto exit;
                 }
 
-                if (write(file_fd, buf, bytes_received) == ERROR) 
+		file_fd = open(DATA_PATH, O_RDONLY, 0644);
+#endif
+            } 
+	    else 
+	    {
+                if (store_append(buf, bytes_received) == ERROR) 
 		{
-                    perror("File write error");
-                    syslog(LOG_ERR, "File write error");
+                    pthread_mutex_unlock(node->thread_mutex);
                     goto exit;
                 }
+#if !USE_AESD_CHAR_DEVICE
+                read_offset = 0;
+#endif
+            }
 
-		// This close executes only when ioctl command is not passed
-                close(file_fd);
+#if !USE_AESD_CHAR_DEVICE
+            // Records are verified lazily, the first time the reply replays them
+            if (record_checksums)
+            {
+                int corrupt = record_index_verify(&record_index,
+                        record_index_find(&record_index, read_offset), record_index.count, true);
+
+                if (corrupt == ERROR)
+                    syslog(LOG_ERR, "Replaying records which could not be verified");
+                else if (corrupt != 0)
+                    syslog(LOG_ERR, "Replaying %d newly found corrupt records", corrupt);
             }
+#endif
 
             if (pthread_mutex_unlock(node->thread_mutex) != SUCCESS) 
 	    {
@@ -419,7 +671,6 @@ void *client_handler(void *client_thread)
                 goto exit;
             }
             // Read from the file and send it to the client
-            int sent_bytes = 0;
             memset(buf, '\0', MAX_BUFFER_SIZE); // Clear the buffer
 
 	    // If ioctl command was not received, we need to reopen for read
@@ -429,6 +680,24 @@ void *client_handler(void *client_thread)
             }
 
 
+#if USE_AESD_CHAR_DEVICE
+            // The driver only exposes complete records, stream them without holding the mutex
+            if (file_fd == ERROR)
+            {
+                perror("File open error");
+                syslog(LOG_ERR, "File Open error");
+                goto exit;
+            }
+
+            if (send_device_records(file_fd, node->connection_fd) == ERROR)
+            {
+                perror("Send records to client failed");
+                syslog(LOG_ERR, "Send records to client failed");
+                goto exit;
+            }
+#else
+            int sent_bytes = 0;
+
             while (1) 
 	    {
                 if (pthread_mutex_lock(node->thread_mutex) != SUCCESS) 
@@ -449,7 +718,9 @@ void *client_handler(void *client_thread)
                 }
 
 
-                int bytes_read = read(file_fd, buf, MAX_BUFFER_SIZE);
+                int bytes_read = pread(file_fd, buf, MAX_BUFFER_SIZE, read_offset);
+                if (bytes_read > 0)
+                    read_offset += bytes_read;
 
                 if (pthread_mutex_unlock(node->thread_mutex) != SUCCESS) 
 		{
@@ -478,15 +749,21 @@ void *client_handler(void *client_thread)
                 if (bytes_read == 0)
                     break;
             }
+#endif
+
+            // Every reply opens the data file again, do not leak it on persistent connections
+            close(file_fd);
+            file_fd = ERROR;
         }
     }
 
-	// Thread has been completed after no data is sent over connection
-    node->thread_completion_status = true;
-  
 exit:
-    close(node->connection_fd);
+    capture_event(&capture_writer, node->connection_id, CAPTURE_EVENT_CLOSE, NULL, 0);
     close(file_fd);
+
+    // End the connection now so the client sees EOF, main joins the thread and closes the fd
+    shutdown(node->connection_fd, SHUT_RDWR);
+    node->thread_completion_status = true;
     return client_thread;
 }
 
@@ -495,12 +772,41 @@ int main(int argc, char *argv[])
 {
     openlog("aesdsocket", LOG_CONS | LOG_PID, LOG_USER);
 
+    int option;
+    const char *capture_path = NULL;
+    uint32_t next_connection_id = 1;  // 0 is reserved for the shared ring
+
     // Check if -d is passed to run this application as a daemon
-    if ((argc == 2) && strcmp(argv[1], "-d") == 0) 
+    while ((option = getopt(argc, argv, OPTIONS)) != ERROR)
     {
+        switch (option)
+        {
+            case 'd':
+                daemon_flag = true;
+                break;
+
+            case 'r':
+                capture_path = optarg;  // Record inbound traffic for aesdreplay
+                break;
+
+#if !USE_AESD_CHAR_DEVICE
+            case 'i':
+                record_index_path = optarg;  // Persist the record index in this file
+                break;
+
+            case 'c':
+                record_checksums = true;
+                break;
+#endif
+
+            default:
+                fprintf(stderr, USAGE, argv[0]);
+                return ERROR;
+        }
+    }
+
+    if (daemon_flag == true)
         syslog(LOG_INFO, "Running as daemon");
-        daemon_flag = true;
-    } 
     else
         syslog(LOG_INFO, "Not running as daemon");
 
@@ -582,6 +888,28 @@ int main(int argc, char *argv[])
 
     freeaddrinfo(servinfo);  // Free addr structure
 
+    // Local endpoint for same host clients and shared ring attach requests
+    struct sockaddr_un unix_addr;
+
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+    strncpy(unix_addr.sun_path, UNIX_SOCKET_PATH, sizeof(unix_addr.sun_path) - 1);
+    unlink(UNIX_SOCKET_PATH);  // Stale socket from a previous run
+
+    unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if ((unix_fd == ERROR) || (bind(unix_fd, (struct sockaddr *) &unix_addr, sizeof(unix_addr)) == ERROR)) 
+    {
+        perror("unix:bind");
+        syslog(LOG_ERR, "Binding failure at unix socket");
+        return ERROR;
+    }
+
+    if ((capture_path != NULL) && (capture_open(&capture_writer, capture_path) == ERROR))
+    {
+        return ERROR;
+    }
+
     int daemon_status = 0;
 
     // Check if application is run in daemon mode
@@ -594,7 +922,7 @@ int main(int argc, char *argv[])
         return ERROR;
     }
 
-    if (listen(server_fd, BACKLOG) == ERROR) 
+    if ((listen(server_fd, BACKLOG) == ERROR) || (listen(unix_fd, BACKLOG) == ERROR)) 
     {
         perror("listen");
         syslog(LOG_ERR, "listen failed");
@@ -603,7 +931,47 @@ int main(int argc, char *argv[])
 
     syslog(LOG_DEBUG, "Listening for connections");
 
-#ifndef USE_AESD_CHAR_DEVICE
+    pthread_t drainer_thread_id;
+
+    if (shm_ring_create(&shm_ring, SHM_RING_DEFAULT_SIZE) == ERROR)
+    {
+        syslog(LOG_ERR, "Shared ring creation");
+        return ERROR;
+    }
+
+    if (pthread_create(&drainer_thread_id, NULL, shm_ring_drainer, &thread_mutex) != SUCCESS)
+    {
+        perror("pthread_create() for shared ring drainer");
+        syslog(LOG_ERR, "pthread_create() for shared ring drainer");
+        return ERROR;
+    }
+
+#if !USE_AESD_CHAR_DEVICE
+    // Data file kept open for the timestamp thread and used to build the record index
+    file_fd = open(DATA_PATH, O_CREAT | O_RDWR | O_APPEND, 0666);
+
+    if(file_fd == ERROR)
+    {
+        perror("Data file open");
+        syslog(LOG_ERR, "Data file open");
+        return ERROR;
+    }
+
+    if(record_index_init(&record_index, file_fd, record_index_path, record_checksums) == ERROR)
+    {
+        syslog(LOG_ERR, "Record index initialization");
+        return ERROR;
+    }
+
+    // Startup sweep over every persisted record, replays still verify what they send
+    if(record_checksums)
+    {
+        int corrupt = record_index_verify(&record_index, 0, record_index.count, false);
+
+        if(corrupt != 0)
+            syslog(LOG_ERR, "Startup verification found %d corrupt records", corrupt);
+    }
+
     // Malloc for timer thread
     time_node = (timestamp_t*)malloc(sizeof(timestamp_t));
 
@@ -629,8 +997,27 @@ int main(int argc, char *argv[])
 
     while (!exit_flag) 
     {
+        struct pollfd listen_fds[2] = {
+            { .fd = server_fd, .events = POLLIN },
+            { .fd = unix_fd, .events = POLLIN },
+        };
+
+        // Wait for either the TCP or the UNIX listener
+        if (poll(listen_fds, 2, -1) == ERROR)
+        {
+            if (exit_flag == 0 && errno == EINTR)
+                continue;
+            if (exit_flag == 0)
+                return ERROR;
+            else
+                break;
+        }
+
+        bool local_connection = (listen_fds[0].revents == 0);
+
         // Accept client connections
-        client_fd = accept(server_fd, (struct sockaddr *) &their_addr, &sin_size);
+        sin_size = sizeof(struct sockaddr_storage);
+        client_fd = accept(local_connection ? unix_fd : server_fd, (struct sockaddr *) &their_addr, &sin_size);
 
         if (client_fd == ERROR) 
 	{
@@ -644,8 +1031,9 @@ int main(int argc, char *argv[])
 
         syslog(LOG_DEBUG, "Connection accepted");
 
-        inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr *) &their_addr),
-                  s, sizeof s);
+        if (!local_connection)
+            inet_ntop(their_addr.ss_family, get_in_addr((struct sockaddr *) &their_addr),
+                      s, sizeof s);
 
         data_node_ptr = (client_node_t *) malloc(sizeof(client_node_t));
 
@@ -659,6 +1047,8 @@ int main(int argc, char *argv[])
         data_node_ptr->connection_fd = client_fd;
         data_node_ptr->thread_mutex = &thread_mutex;
         data_node_ptr->thread_completion_status = false;
+        data_node_ptr->local_connection = local_connection;
+        data_node_ptr->connection_id = next_connection_id++;
 
         if (pthread_create(&(data_node_ptr->thread_id), NULL, client_handler, data_node_ptr) != SUCCESS) 
 	{
@@ -674,37 +1064,49 @@ int main(int argc, char *argv[])
         data_node_ptr = NULL;
 
         // check for thread completion
-        SLIST_FOREACH(data_node_ptr, &head, next_node) 
+        client_node_t *next_ptr;
+
+        SLIST_FOREACH_SAFE(data_node_ptr, &head, next_node, next_ptr) 
 	{
             if (data_node_ptr->thread_completion_status == true) 
 	    {
                 int status;
                 status = pthread_join(data_node_ptr->thread_id, NULL);
-                if (status == ERROR) 
+                if (status != SUCCESS) 
 		{
                     syslog(LOG_ERR, "Thread join failed");
                     return ERROR;
                 }
 
                 syslog(LOG_INFO, "Thread join %ld", data_node_ptr->thread_id);
+                close(data_node_ptr->connection_fd);
+                SLIST_REMOVE(&head, data_node_ptr, client_node, next_node);
+                free(data_node_ptr);
             }
         }
+        data_node_ptr = NULL;
     }
 
     syslog(LOG_DEBUG, "Finished while loop");
 
-    // Emptying the Linked-list
+    // Emptying the Linked-list, clients still connected are woken and joined before cleanup
     while (!SLIST_EMPTY(&head)) 
     {
         data_node_ptr = SLIST_FIRST(&head);
         SLIST_REMOVE(&head, data_node_ptr, client_node, next_node);
+        shutdown(data_node_ptr->connection_fd, SHUT_RDWR);
+        pthread_join(data_node_ptr->thread_id, NULL);
+        close(data_node_ptr->connection_fd);
         free(data_node_ptr);
         data_node_ptr = NULL;
     }
 
     syslog(LOG_DEBUG, "Finished emptying linked list for client handling threads");
 
-#ifndef USE_AESD_CHAR_DEVICE
+    pthread_join(drainer_thread_id, NULL);  // Drains whatever producers already committed
+    syslog(LOG_DEBUG, "Joined shared ring drainer thread");
+
+#if !USE_AESD_CHAR_DEVICE
     pthread_join(time_node -> thread_id, NULL);  // Timer thread
     syslog(LOG_DEBUG, "Joined timer thread");
     free(time_node);
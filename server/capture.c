@@ -0,0 +1,186 @@
+/**
+ * @file    capture.c
+ * @brief   Binary capture of the inbound record stream of aesdsocket
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Writer used by aesdsocket and reader used by aesdreplay, see
+ * capture.h for the file format.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include "capture.h"
+
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+
+
+/**
+ * Returns the monotonic clock in nanoseconds
+ */
+uint64_t capture_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+/**
+ * Creates the capture file at @param path and writes its header. @param writer must be
+ * set up with CAPTURE_WRITER_INITIALIZER and is opened before any other thread runs.
+ * Return value: 0 on success, -1 on failure
+ */
+int capture_open(capture_writer_t *writer, const char *path)
+{
+    struct capture_file_header header;
+    struct timespec now;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        perror("Capture open");
+        syslog(LOG_ERR, "Capture open failed");
+        return -1;
+    }
+
+    // Events are small, batch them in a large stdio buffer
+    setvbuf(writer->file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    writer->start_ns = capture_now_ns();
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.start_realtime_sec = now.tv_sec;
+    header.start_realtime_nsec = now.tv_nsec;
+
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1)
+    {
+        perror("Capture header write");
+        syslog(LOG_ERR, "Capture header write failed");
+        capture_close(writer);
+        return -1;
+    }
+
+    // Nothing may sit in the stdio buffer if the caller forks afterwards
+    fflush(writer->file);
+    return 0;
+}
+
+/**
+ * Appends one event of @param type for @param connection_id to the capture,
+ * with @param length bytes of payload from @param data. A close event is flushed
+ * right away, so the capture of every finished connection can be replayed.
+ * Does nothing when the writer is not open, safe to call from any thread.
+ */
+void capture_event(capture_writer_t *writer, uint32_t connection_id, uint16_t type,
+        const char *data, size_t length)
+{
+    struct capture_event_header header;
+
+    memset(&header, 0, sizeof(header));
+    header.timestamp_ns = capture_now_ns() - writer->start_ns;
+    header.connection_id = connection_id;
+    header.type = type;
+    header.length = length;
+
+    // The capture may be closed concurrently, file is only checked under the mutex
+    pthread_mutex_lock(&writer->mutex);
+    if (writer->file == NULL)
+    {
+        pthread_mutex_unlock(&writer->mutex);
+        return;
+    }
+
+    if ((fwrite(&header, sizeof(header), 1, writer->file) != 1) ||
+        ((length > 0) && (fwrite(data, length, 1, writer->file) != 1)))
+    {
+        syslog(LOG_ERR, "Capture write failed");
+    }
+    if (type == CAPTURE_EVENT_CLOSE)
+        fflush(writer->file);
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+/**
+ * Writes the events buffered by @param writer to the capture file, called periodically
+ * so the capture stays readable and survives a crash of the server.
+ * Does nothing when the writer is not open, safe to call from any thread.
+ */
+void capture_flush(capture_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    if ((writer->file != NULL) && (fflush(writer->file) != 0))
+        syslog(LOG_ERR, "Capture flush failed");
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+/**
+ * Flushes and closes the capture. The mutex is statically initialized and stays valid,
+ * so events of threads still running are dropped rather than written to a closed file.
+ */
+void capture_close(capture_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->mutex);
+    if (writer->file != NULL)
+        fclose(writer->file);
+    writer->file = NULL;
+    pthread_mutex_unlock(&writer->mutex);
+}
+
+/**
+ * Opens the capture at @param path for reading and validates its header,
+ * which is returned in @param header_rtn.
+ * Return value: the open capture, NULL on failure
+ */
+FILE *capture_read_open(const char *path, struct capture_file_header *header_rtn)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL)
+        return NULL;
+
+    if ((fread(header_rtn, sizeof(*header_rtn), 1, file) != 1) ||
+        (memcmp(header_rtn->magic, CAPTURE_MAGIC, sizeof(header_rtn->magic)) != 0) ||
+        (header_rtn->version != CAPTURE_VERSION))
+    {
+        fclose(file);
+        errno = EINVAL;
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * Reads the next event from @param file into @param event, allocating its payload.
+ * An event cut short at the end of the file, by a capture still being written or a
+ * server which crashed, ends the capture like a clean end of file.
+ * Return value: 1 when an event was read, 0 at the end of the capture, -1 on an
+ * unreadable capture
+ */
+int capture_read_event(FILE *file, capture_event_t *event)
+{
+    event->data = NULL;
+
+    if (fread(&event->header, sizeof(event->header), 1, file) != 1)
+        return feof(file) ? 0 : -1;
+
+    if (event->header.length == 0)
+        return 1;
+
+    event->data = malloc(event->header.length);
+    if ((event->data == NULL) || (fread(event->data, event->header.length, 1, file) != 1))
+    {
+        int result = ((event->data != NULL) && feof(file)) ? 0 : -1;
+
+        free(event->data);
+        event->data = NULL;
+        return result;
+    }
+    return 1;
+}
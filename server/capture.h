@@ -0,0 +1,79 @@
+/**
+ * @file    capture.h
+ * @brief   Binary capture of the inbound record stream of aesdsocket
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  A capture file starts with a capture_file_header followed by one
+ * capture_event_header per event, each immediately followed by length bytes of
+ * payload for CAPTURE_EVENT_DATA. Timestamps are nanoseconds on the monotonic clock
+ * since the capture was opened. All fields are in host byte order, captures are
+ * meant to be replayed on the same kind of machine they were taken on.
+ *
+ * Connection ID 0 is used for records drained from the shared memory ring.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC "AESDCAP1"
+#define CAPTURE_VERSION (1)
+
+#define CAPTURE_EVENT_OPEN (1)   // Connection accepted
+#define CAPTURE_EVENT_DATA (2)   // Bytes received on the connection
+#define CAPTURE_EVENT_CLOSE (3)  // Connection closed
+
+struct capture_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t start_realtime_sec;   // Wall clock time the capture was opened
+    int64_t start_realtime_nsec;
+} __attribute__((packed));
+
+struct capture_event_header
+{
+    uint64_t timestamp_ns;
+    uint32_t connection_id;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t length;
+} __attribute__((packed));
+
+typedef struct capture_writer
+{
+    FILE *file;  // NULL while the capture is not open, only changed under mutex
+    pthread_mutex_t mutex;
+    uint64_t start_ns;
+} capture_writer_t;
+
+// A writer starts closed, capture_event() may be called on it before and after the capture
+#define CAPTURE_WRITER_INITIALIZER { .file = NULL, .mutex = PTHREAD_MUTEX_INITIALIZER }
+
+typedef struct capture_event
+{
+    struct capture_event_header header;
+    char *data;  // Allocated by capture_read_event(), NULL when length is 0
+} capture_event_t;
+
+extern uint64_t capture_now_ns(void);
+
+extern int capture_open(capture_writer_t *writer, const char *path);
+
+extern void capture_event(capture_writer_t *writer, uint32_t connection_id, uint16_t type,
+            const char *data, size_t length);
+
+extern void capture_flush(capture_writer_t *writer);
+
+extern void capture_close(capture_writer_t *writer);
+
+extern FILE *capture_read_open(const char *path, struct capture_file_header *header_rtn);
+
+extern int capture_read_event(FILE *file, capture_event_t *event);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,62 @@
+/**
+ * @file    client_connect.c
+ * @brief   Connection helper shared by the aesdsocket load tools
+ * @author  Aamir Suhail Burhan
+ *
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "client_connect.h"
+
+/**
+ * Opens a stream connection to aesdsocket, over the UNIX socket at @param unix_path
+ * when it is not NULL, otherwise over TCP to @param host and @param port.
+ * Return value: the connected socket, -1 on failure
+ */
+int client_connect(const char *host, const char *port, const char *unix_path)
+{
+    struct addrinfo hints, *servinfo, *p;
+    int fd = -1;
+
+    if (unix_path != NULL)
+    {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if ((fd != -1) && (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1))
+        {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &servinfo) != 0)
+        return -1;
+
+    for (p = servinfo; p != NULL; p = p->ai_next)
+    {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(servinfo);
+    return fd;
+}
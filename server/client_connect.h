@@ -0,0 +1,12 @@
+/**
+ * @file    client_connect.h
+ * @brief   Connection helper shared by the aesdsocket load tools
+ * @author  Aamir Suhail Burhan
+ */
+
+#ifndef CLIENT_CONNECT_H
+#define CLIENT_CONNECT_H
+
+extern int client_connect(const char *host, const char *port, const char *unix_path);
+
+#endif /* CLIENT_CONNECT_H */
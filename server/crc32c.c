@@ -0,0 +1,308 @@
+/**
+ * @file    crc32c.c
+ * @brief   CRC-32C (Castagnoli) used to protect records in the file backed data store
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Hardware and table driven CRC-32C with runtime dispatch.
+ *
+ * References:
+ * 1. Mark Adler, crc32c.c -- compute CRC-32C using the Intel crc32 instruction
+ *    https://stackoverflow.com/a/17646775
+ * 2. Intel, Fast CRC Computation for iSCSI Polynomial Using CRC32 Instruction
+ *
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42
+#endif
+
+#define CRC32C_POLY (0x82f63b78)  // Reflected Castagnoli polynomial
+
+// Block sizes for the three way parallel hardware crc, both must be powers of two
+#define CRC32C_LONG (8192)
+#define CRC32C_SHORT (256)
+
+static uint32_t crc32c_table[8][256];  // Slice by eight tables
+
+#ifdef CRC32C_HAVE_SSE42
+static uint32_t crc32c_long[4][256];   // Operator appending CRC32C_LONG zero bytes
+static uint32_t crc32c_short[4][256];  // Operator appending CRC32C_SHORT zero bytes
+#endif
+
+static uint32_t (*crc32c_impl)(uint32_t, const void *, size_t) = crc32c_software;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+
+/* Description: Loads eight bytes from a possibly unaligned address
+ */
+static inline uint64_t crc32c_load64(const unsigned char *next)
+{
+    uint64_t word;
+
+    memcpy(&word, next, sizeof(word));
+    return word;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+/* Description: Multiplies the 32x32 GF(2) matrix mat by the vector vec
+ */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    while (vec)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+/* Description: Squares the 32x32 GF(2) matrix mat into square
+ */
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    int n;
+
+    for (n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Description: Builds the operator which appends length zero bytes to a crc,
+ * length must be a power of two.
+ */
+static void crc32c_zeros_op(uint32_t *even, size_t length)
+{
+    uint32_t odd[32];
+    uint32_t row = 1;
+    int n;
+
+    // Operator for one zero bit
+    odd[0] = CRC32C_POLY;
+    for (n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);  // Two zero bits
+    gf2_matrix_square(odd, even);  // Four zero bits
+
+    // Each square doubles the number of zero bytes, starting from one byte
+    do
+    {
+        gf2_matrix_square(even, odd);
+        length >>= 1;
+        if (length == 0)
+            return;
+        gf2_matrix_square(odd, even);
+        length >>= 1;
+    } while (length);
+
+    memcpy(even, odd, sizeof(odd));
+}
+
+/* Description: Expands the zeros operator for length bytes into byte wise tables
+ */
+static void crc32c_zeros(uint32_t zeros[][256], size_t length)
+{
+    uint32_t op[32];
+    uint32_t n;
+
+    crc32c_zeros_op(op, length);
+    for (n = 0; n < 256; n++)
+    {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+/* Description: Applies a zeros operator table to crc
+ */
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+           zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+#endif
+
+/* Description: Builds the tables and selects the implementation, runs once
+ */
+static void crc32c_init(void)
+{
+    uint32_t n, k, crc;
+
+    for (n = 0; n < 256; n++)
+    {
+        crc = n;
+        for (k = 0; k < 8; k++)
+            crc = (crc & 1) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1);
+        crc32c_table[0][n] = crc;
+    }
+
+    for (n = 0; n < 256; n++)
+    {
+        crc = crc32c_table[0][n];
+        for (k = 1; k < 8; k++)
+        {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[k][n] = crc;
+        }
+    }
+
+#ifdef CRC32C_HAVE_SSE42
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+
+    if (__builtin_cpu_supports("sse4.2"))
+        crc32c_impl = crc32c_hardware;
+#endif
+}
+
+/**
+ * Table driven CRC-32C of @param length bytes at @param buf, continuing from @param crc
+ */
+uint32_t crc32c_software(uint32_t crc, const void *buf, size_t length)
+{
+    const unsigned char *next = buf;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc = ~crc;
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    while (length >= 8)
+    {
+        uint64_t word = crc32c_load64(next) ^ crc;
+
+        crc = crc32c_table[7][word & 0xff] ^
+              crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^
+              crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^
+              crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^
+              crc32c_table[0][word >> 56];
+        next += 8;
+        length -= 8;
+    }
+#endif
+
+    while (length)
+    {
+        crc = crc32c_table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    return ~crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+/**
+ * CRC-32C of @param length bytes at @param buf, continuing from @param crc, using the
+ * SSE4.2 crc32 instruction. Only call this when crc32c_hardware_supported() is true.
+ */
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(uint32_t crc, const void *buf, size_t length)
+{
+    const unsigned char *next = buf;
+    const unsigned char *end;
+    uint64_t crc0, crc1, crc2;
+
+    pthread_once(&crc32c_once, crc32c_init);
+    crc0 = crc ^ 0xffffffff;
+
+    // Bring the data pointer to an eight byte boundary
+    while (length && (((uintptr_t) next & 7) != 0))
+    {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+        length--;
+    }
+
+    // The instruction has a latency of three cycles but a throughput of one per
+    // cycle, so three independent streams are run and combined with the zeros operator
+    while (length >= (CRC32C_LONG * 3))
+    {
+        crc1 = 0;
+        crc2 = 0;
+        end = next + CRC32C_LONG;
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, crc32c_load64(next));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load64(next + CRC32C_LONG));
+            crc2 = _mm_crc32_u64(crc2, crc32c_load64(next + (CRC32C_LONG * 2)));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+        next += CRC32C_LONG * 2;
+        length -= CRC32C_LONG * 3;
+    }
+
+    while (length >= (CRC32C_SHORT * 3))
+    {
+        crc1 = 0;
+        crc2 = 0;
+        end = next + CRC32C_SHORT;
+        do
+        {
+            crc0 = _mm_crc32_u64(crc0, crc32c_load64(next));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load64(next + CRC32C_SHORT));
+            crc2 = _mm_crc32_u64(crc2, crc32c_load64(next + (CRC32C_SHORT * 2)));
+            next += 8;
+        } while (next < end);
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+        crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+        next += CRC32C_SHORT * 2;
+        length -= CRC32C_SHORT * 3;
+    }
+
+    // Remaining eight byte words, then the trailing bytes
+    end = next + (length - (length & 7));
+    while (next < end)
+    {
+        crc0 = _mm_crc32_u64(crc0, crc32c_load64(next));
+        next += 8;
+    }
+    length &= 7;
+
+    while (length)
+    {
+        crc0 = _mm_crc32_u8(crc0, *next++);
+        length--;
+    }
+
+    return (uint32_t) crc0 ^ 0xffffffff;
+}
+#else
+uint32_t crc32c_hardware(uint32_t crc, const void *buf, size_t length)
+{
+    return crc32c_software(crc, buf, length);
+}
+#endif
+
+/**
+ * Returns true when crc32c() runs on the crc32 instruction
+ */
+bool crc32c_hardware_supported(void)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl == crc32c_hardware;
+}
+
+/**
+ * CRC-32C of @param length bytes at @param buf, continuing from @param crc,
+ * using the fastest implementation available on this CPU
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t length)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    return crc32c_impl(crc, buf, length);
+}
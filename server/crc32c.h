@@ -0,0 +1,27 @@
+/**
+ * @file    crc32c.h
+ * @brief   CRC-32C (Castagnoli) used to protect records in the file backed data store
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  crc32c() uses the SSE4.2 crc32 instruction when the CPU supports it,
+ * running three independent streams to hide the instruction latency, and a slice by
+ * eight table driven implementation otherwise. The running value is chained like zlib:
+ * start with 0 and pass the previous result back in for the next piece of the record.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+extern uint32_t crc32c(uint32_t crc, const void *buf, size_t length);
+
+extern uint32_t crc32c_software(uint32_t crc, const void *buf, size_t length);
+
+extern uint32_t crc32c_hardware(uint32_t crc, const void *buf, size_t length);
+
+extern bool crc32c_hardware_supported(void);
+
+#endif /* CRC32C_H */
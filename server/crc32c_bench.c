@@ -0,0 +1,107 @@
+/**
+ * @file    crc32c_bench.c
+ * @brief   Throughput benchmark for the CRC-32C implementations
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Checks the implementations against the CRC-32C check value and
+ * against each other, then reports MB/s for record sized and bulk buffers so the
+ * cost of leaving per record checksums on can be compared between changes.
+ * Build with "make bench", run as ./crc32c_bench [total_megabytes].
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "crc32c.h"
+
+#define CRC32C_CHECK_VALUE (0xe3069283)  // CRC-32C of "123456789"
+#define DEFAULT_TOTAL_MB (256)
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096, 65536, 1024 * 1024 };
+
+
+/* Description: Returns the monotonic clock in seconds
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Description: Runs impl over buf in chunks of size until total bytes were processed,
+ * returns the throughput in MB/s
+ */
+static double bench_run(uint32_t (*impl)(uint32_t, const void *, size_t),
+        const unsigned char *buf, size_t size, size_t total, uint32_t *sink)
+{
+    size_t iterations = (total / size) ? (total / size) : 1;
+    uint32_t crc = 0;
+    double start = now_seconds();
+    size_t i;
+
+    for (i = 0; i < iterations; i++)
+        crc ^= impl(0, buf, size);
+
+    *sink ^= crc;
+    return ((double) iterations * size) / (now_seconds() - start) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t total = (size_t) ((argc > 1) ? atoi(argv[1]) : DEFAULT_TOTAL_MB) * 1024 * 1024;
+    size_t largest = bench_sizes[(sizeof(bench_sizes) / sizeof(bench_sizes[0])) - 1];
+    unsigned char *buf = malloc(largest + 1);
+    uint32_t sink = 0;
+    size_t i, size;
+
+    if (buf == NULL)
+    {
+        perror("Malloc for benchmark buffer");
+        return 1;
+    }
+
+    for (i = 0; i < largest + 1; i++)
+        buf[i] = (unsigned char) (rand() & 0xff);
+
+    // Correctness first, benchmarks of a wrong implementation are worthless
+    if ((crc32c_software(0, "123456789", 9) != CRC32C_CHECK_VALUE) ||
+        (crc32c_hardware_supported() && (crc32c_hardware(0, "123456789", 9) != CRC32C_CHECK_VALUE)))
+    {
+        fprintf(stderr, "CRC-32C check value mismatch\n");
+        return 1;
+    }
+
+    for (size = 0; size <= largest; size += (size < 1024) ? 1 : 4093)
+    {
+        uint32_t expect = crc32c_software(0, buf + 1, size);
+        uint32_t split = crc32c(crc32c(0, buf + 1, size / 3), buf + 1 + (size / 3), size - (size / 3));
+
+        if ((crc32c(0, buf + 1, size) != expect) || (split != expect))
+        {
+            fprintf(stderr, "CRC-32C implementations disagree at %zu bytes\n", size);
+            return 1;
+        }
+    }
+
+    printf("# crc32c hardware=%s total=%zuMB\n", crc32c_hardware_supported() ? "sse4.2" : "none",
+            total / (1024 * 1024));
+    printf("%-10s %14s %14s\n", "size", "software_MB/s", "hardware_MB/s");
+
+    for (i = 0; i < sizeof(bench_sizes) / sizeof(bench_sizes[0]); i++)
+    {
+        size = bench_sizes[i];
+        double software = bench_run(crc32c_software, buf, size, total, &sink);
+
+        if (crc32c_hardware_supported())
+            printf("%-10zu %14.1f %14.1f\n", size, software, bench_run(crc32c_hardware, buf, size, total, &sink));
+        else
+            printf("%-10zu %14.1f %14s\n", size, software, "-");
+    }
+
+    free(buf);
+    return (sink == 0xffffffff) ? 2 : 0;  // Keeps the results observable
+}
@@ -0,0 +1,147 @@
+/**
+ * @file    latency_stats.c
+ * @brief   Latency sample collection and percentiles for the aesdsocket load tools
+ * @author  Aamir Suhail Burhan
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "latency_stats.h"
+
+#define LATENCY_STATS_INITIAL_CAPACITY (1024)
+
+
+/* Description: qsort comparison for uint64_t samples
+ */
+static int latency_stats_compare(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t *) a;
+    uint64_t right = *(const uint64_t *) b;
+
+    return (left > right) - (left < right);
+}
+
+/* Description: Makes room for at least extra more samples
+ */
+static int latency_stats_reserve(latency_stats_t *stats, size_t extra)
+{
+    size_t new_capacity = stats->capacity ? stats->capacity : LATENCY_STATS_INITIAL_CAPACITY;
+    uint64_t *new_samples;
+
+    if ((stats->count + extra) <= stats->capacity)
+        return 0;
+
+    while (new_capacity < (stats->count + extra))
+        new_capacity *= 2;
+
+    new_samples = realloc(stats->samples, new_capacity * sizeof(uint64_t));
+    if (new_samples == NULL)
+        return -1;
+
+    stats->samples = new_samples;
+    stats->capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Initializes @param stats with no samples
+ */
+void latency_stats_init(latency_stats_t *stats)
+{
+    memset(stats, 0, sizeof(latency_stats_t));
+}
+
+/**
+ * Records @param sample_ns in @param stats
+ * Return value: 0 on success, -1 if memory could not be allocated
+ */
+int latency_stats_add(latency_stats_t *stats, uint64_t sample_ns)
+{
+    if (latency_stats_reserve(stats, 1) != 0)
+        return -1;
+
+    stats->samples[stats->count++] = sample_ns;
+    return 0;
+}
+
+/**
+ * Appends every sample of @param other to @param stats
+ * Return value: 0 on success, -1 if memory could not be allocated
+ */
+int latency_stats_merge(latency_stats_t *stats, const latency_stats_t *other)
+{
+    if (other->count == 0)
+        return 0;
+
+    if (latency_stats_reserve(stats, other->count) != 0)
+        return -1;
+
+    memcpy(stats->samples + stats->count, other->samples, other->count * sizeof(uint64_t));
+    stats->count += other->count;
+    return 0;
+}
+
+/**
+ * Sorts the samples of @param stats, must be called before reading percentiles
+ */
+void latency_stats_finish(latency_stats_t *stats)
+{
+    if (stats->count > 1)
+        qsort(stats->samples, stats->count, sizeof(uint64_t), latency_stats_compare);
+}
+
+/**
+ * Returns the nearest rank @param percentile (0 to 100) of the sorted samples in nanoseconds,
+ * 0 when there are no samples
+ */
+uint64_t latency_stats_percentile(const latency_stats_t *stats, double percentile)
+{
+    size_t rank;
+
+    if (stats->count == 0)
+        return 0;
+
+    rank = (size_t) ((percentile / 100.0) * stats->count);
+    if (rank >= stats->count)
+        rank = stats->count - 1;
+
+    return stats->samples[rank];
+}
+
+/**
+ * Prints a one line human readable summary of @param stats in microseconds to @param out
+ */
+void latency_stats_print(const latency_stats_t *stats, FILE *out)
+{
+    fprintf(out, "latency_us samples=%zu p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+            stats->count,
+            latency_stats_percentile(stats, 50.0) / 1e3,
+            latency_stats_percentile(stats, 90.0) / 1e3,
+            latency_stats_percentile(stats, 99.0) / 1e3,
+            latency_stats_percentile(stats, 99.9) / 1e3,
+            latency_stats_percentile(stats, 100.0) / 1e3);
+}
+
+/**
+ * Prints @param stats as a JSON object with nanosecond values to @param out, without a newline
+ */
+void latency_stats_print_json(const latency_stats_t *stats, FILE *out)
+{
+    fprintf(out, "{\"samples\":%zu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}",
+            stats->count,
+            (unsigned long long) latency_stats_percentile(stats, 50.0),
+            (unsigned long long) latency_stats_percentile(stats, 90.0),
+            (unsigned long long) latency_stats_percentile(stats, 99.0),
+            (unsigned long long) latency_stats_percentile(stats, 99.9),
+            (unsigned long long) latency_stats_percentile(stats, 100.0));
+}
+
+/**
+ * Releases the samples held by @param stats
+ */
+void latency_stats_free(latency_stats_t *stats)
+{
+    free(stats->samples);
+    latency_stats_init(stats);
+}
@@ -0,0 +1,40 @@
+/**
+ * @file    latency_stats.h
+ * @brief   Latency sample collection and percentiles for the aesdsocket load tools
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Every sample is kept so that percentiles are exact. Each worker thread
+ * owns a latency_stats_t and the results are merged once the workers are joined.
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct latency_stats
+{
+    uint64_t *samples;  // Nanoseconds, sorted by latency_stats_finish()
+    size_t count;
+    size_t capacity;
+} latency_stats_t;
+
+extern void latency_stats_init(latency_stats_t *stats);
+
+extern int latency_stats_add(latency_stats_t *stats, uint64_t sample_ns);
+
+extern int latency_stats_merge(latency_stats_t *stats, const latency_stats_t *other);
+
+extern void latency_stats_finish(latency_stats_t *stats);
+
+extern uint64_t latency_stats_percentile(const latency_stats_t *stats, double percentile);
+
+extern void latency_stats_print(const latency_stats_t *stats, FILE *out);
+
+extern void latency_stats_print_json(const latency_stats_t *stats, FILE *out);
+
+extern void latency_stats_free(latency_stats_t *stats);
+
+#endif /* LATENCY_STATS_H */
@@ -0,0 +1,357 @@
+/**
+ * @file    record_index.c
+ * @brief   Record number to byte offset index for the file backed data store
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  Keeps the start offset of each newline terminated record appended
+ * to the data file so that AESDCHAR_IOCSEEKTO:X,Y can be resolved without the
+ * aesdchar driver. The persisted index is a flat file of record_index_entry, one
+ * per complete record, appended in the same order as the data file.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include "record_index.h"
+#include "crc32c.h"
+
+#define RECORD_INDEX_INITIAL_CAPACITY (64)
+#define RECORD_INDEX_SCAN_SIZE (4096)
+#define RECORD_INDEX_VERIFY_SIZE (65536)
+
+/******************On disk format of one persisted record******************/
+struct record_index_entry
+{
+    uint64_t end;    // Offset one past the newline ending the record
+    uint32_t crc;    // CRC-32C of the record when flags has RECORD_CHECK_PRESENT
+    uint32_t flags;
+};
+
+
+/* Description: Adds the start offset of the next record after a record has been
+ * completed, growing the index arrays geometrically. The completed record is
+ * written to the persisted index when persist is set and the index is file backed.
+ * Returns 0 on success, -1 on failure.
+ */
+static int record_index_push(record_index_t *index, off_t next_start, record_check_t check, bool persist)
+{
+    if ((index->count + 1) >= index->capacity)
+    {
+        size_t new_capacity = index->capacity * 2;
+        off_t *new_offsets = realloc(index->offsets, new_capacity * sizeof(off_t));
+        record_check_t *new_checks;
+
+        if (new_offsets == NULL)
+        {
+            syslog(LOG_ERR, "Realloc for record index failed");
+            return -1;
+        }
+        index->offsets = new_offsets;
+
+        new_checks = realloc(index->checks, new_capacity * sizeof(record_check_t));
+        if (new_checks == NULL)
+        {
+            syslog(LOG_ERR, "Realloc for record checks failed");
+            return -1;
+        }
+        index->checks = new_checks;
+        index->capacity = new_capacity;
+    }
+
+    index->checks[index->count] = check;
+    index->count++;
+    index->offsets[index->count] = next_start;
+
+    if (persist && (index->persist_fd != -1))
+    {
+        struct record_index_entry entry = {
+            .end = (uint64_t) next_start,
+            .crc = check.crc,
+            .flags = check.flags & RECORD_CHECK_PRESENT,
+        };
+
+        if (write(index->persist_fd, &entry, sizeof(entry)) != sizeof(entry))
+        {
+            // Stop persisting rather than leave a file which disagrees with memory
+            perror("Record index persist");
+            syslog(LOG_ERR, "Record index persist failed, continuing memory only");
+            close(index->persist_fd);
+            index->persist_fd = -1;
+        }
+    }
+    return 0;
+}
+
+/* Description: Loads the persisted records, keeping the longest prefix which is
+ * consistent with a data file of data_end bytes. The persisted file is truncated to
+ * that prefix so that later appends line up with the in memory index.
+ */
+static void record_index_load(record_index_t *index, int data_fd, off_t data_end)
+{
+    struct record_index_entry entry;
+    size_t loaded = 0;
+    char last_byte;
+
+    while (read(index->persist_fd, &entry, sizeof(entry)) == sizeof(entry))
+    {
+        record_check_t check = { .crc = entry.crc, .flags = entry.flags & RECORD_CHECK_PRESENT };
+
+        if (((off_t) entry.end <= index->offsets[index->count]) || ((off_t) entry.end > data_end))
+            break;
+
+        // The entry is already on disk so it is not persisted again
+        if (record_index_push(index, (off_t) entry.end, check, false) != 0)
+            break;
+        loaded++;
+    }
+
+    // The last loaded record must end on a newline, otherwise the data file was replaced
+    if (loaded > 0)
+    {
+        if ((pread(data_fd, &last_byte, 1, index->offsets[index->count] - 1) != 1) || (last_byte != '\n'))
+        {
+            syslog(LOG_INFO, "Persisted record index is stale, rebuilding");
+            index->count = 0;
+            loaded = 0;
+        }
+    }
+
+    if (ftruncate(index->persist_fd, loaded * sizeof(struct record_index_entry)) == -1)
+    {
+        perror("Record index truncate");
+        syslog(LOG_ERR, "Record index truncate failed, continuing memory only");
+        close(index->persist_fd);
+        index->persist_fd = -1;
+    }
+
+    index->data_size = index->offsets[index->count];
+    syslog(LOG_DEBUG, "Loaded %zu persisted records", loaded);
+}
+
+/**
+ * Initializes @param index for the data file open on @param data_fd, which must stay open
+ * for as long as the index is used.
+ * If @param persist_path is not NULL the index is loaded from and appended to that file,
+ * any part of the data file not covered by the persisted index is scanned.
+ * With @param checksums set every record appended from now on carries a CRC-32C.
+ * Return value: 0 on success, -1 on failure
+ */
+int record_index_init(record_index_t *index, int data_fd, const char *persist_path, bool checksums)
+{
+    char buf[RECORD_INDEX_SCAN_SIZE];
+    off_t data_end;
+    ssize_t bytes_read;
+
+    memset(index, 0, sizeof(record_index_t));
+    index->data_fd = data_fd;
+    index->persist_fd = -1;
+    index->checksums = checksums;
+
+    index->offsets = malloc(RECORD_INDEX_INITIAL_CAPACITY * sizeof(off_t));
+    index->checks = malloc(RECORD_INDEX_INITIAL_CAPACITY * sizeof(record_check_t));
+    if ((index->offsets == NULL) || (index->checks == NULL))
+    {
+        syslog(LOG_ERR, "Malloc for record index failed");
+        record_index_free(index);
+        return -1;
+    }
+    index->capacity = RECORD_INDEX_INITIAL_CAPACITY;
+    index->offsets[0] = 0;
+
+    data_end = lseek(data_fd, 0, SEEK_END);
+    if (data_end == -1)
+    {
+        perror("Record index seek");
+        syslog(LOG_ERR, "Record index seek failed");
+        record_index_free(index);
+        return -1;
+    }
+
+    if (persist_path != NULL)
+    {
+        index->persist_fd = open(persist_path, O_CREAT | O_RDWR | O_APPEND, 0644);
+        if (index->persist_fd == -1)
+        {
+            perror("Record index open");
+            syslog(LOG_ERR, "Record index open failed, continuing memory only");
+        }
+        else
+        {
+            record_index_load(index, data_fd, data_end);
+        }
+    }
+
+    // Catch up with whatever was appended after the index was last persisted
+    while (index->data_size < data_end)
+    {
+        bytes_read = pread(data_fd, buf, sizeof(buf), index->data_size);
+        if (bytes_read <= 0)
+        {
+            perror("Record index scan");
+            syslog(LOG_ERR, "Record index scan failed");
+            record_index_free(index);
+            return -1;
+        }
+
+        if (record_index_append(index, buf, bytes_read) != 0)
+        {
+            record_index_free(index);
+            return -1;
+        }
+    }
+
+    syslog(LOG_DEBUG, "Record index ready with %zu records", index->count);
+    return 0;
+}
+
+/**
+ * Updates @param index after @param length bytes from @param data were appended
+ * to the end of the data file.
+ * Return value: 0 on success, -1 on failure
+ */
+int record_index_append(record_index_t *index, const char *data, size_t length)
+{
+    const char *scan = data;
+    const char *end = data + length;
+    const char *newline;
+    record_check_t check = { 0 };
+
+    while ((scan < end) && ((newline = memchr(scan, '\n', end - scan)) != NULL))
+    {
+        if (index->checksums)
+        {
+            check.crc = crc32c(index->pending_crc, scan, (newline + 1) - scan);
+            check.flags = RECORD_CHECK_PRESENT;  // Only a read back of the data file verifies it
+            index->pending_crc = 0;
+        }
+
+        if (record_index_push(index, index->data_size + (newline - data) + 1, check, true) != 0)
+            return -1;
+        scan = newline + 1;
+    }
+
+    if (index->checksums && (scan < end))
+        index->pending_crc = crc32c(index->pending_crc, scan, end - scan);
+
+    index->data_size += length;
+    return 0;
+}
+
+/**
+ * Resolves the zero referenced @param record and the zero referenced @param record_offset
+ * within it to a byte offset in the data file, stored in @param position_rtn.
+ * Return value: 0 on success, -1 with errno set to EINVAL if either value is out of range
+ */
+int record_index_lookup(const record_index_t *index, uint32_t record,
+        uint32_t record_offset, off_t *position_rtn)
+{
+    if ((record >= index->count) ||
+        (record_offset >= (index->offsets[record + 1] - index->offsets[record])))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *position_rtn = index->offsets[record] + record_offset;
+    return 0;
+}
+
+/**
+ * Returns the zero referenced record containing byte @param position of the data file,
+ * or the number of complete records if position is past the last complete record
+ */
+size_t record_index_find(const record_index_t *index, off_t position)
+{
+    size_t low = 0;
+    size_t high = index->count;
+
+    // Binary search for the last record starting at or before position
+    while (low < high)
+    {
+        size_t mid = low + ((high - low + 1) / 2);
+
+        if (index->offsets[mid] <= position)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/**
+ * Verifies the CRC-32C of records @param first up to but excluding @param last against
+ * the data file. Records without a checksum, records which were already verified and
+ * records already found corrupt are skipped, every new mismatch is logged once.
+ * Matching records are only remembered as verified with @param mark_verified, so a
+ * sweep leaves them to be checked again when they are replayed.
+ * Return value: number of newly found corrupt records, -1 if the data file could not be read
+ */
+int record_index_verify(record_index_t *index, size_t first, size_t last, bool mark_verified)
+{
+    static char buf[RECORD_INDEX_VERIFY_SIZE];  // Caller holds the index lock
+    int corrupt = 0;
+    size_t record;
+
+    if (last > index->count)
+        last = index->count;
+
+    for (record = first; record < last; record++)
+    {
+        record_check_t *check = &index->checks[record];
+        off_t position = index->offsets[record];
+        uint32_t crc = 0;
+
+        if (((check->flags & RECORD_CHECK_PRESENT) == 0) ||
+            (check->flags & (RECORD_CHECK_VERIFIED | RECORD_CHECK_CORRUPT)))
+            continue;
+
+        while (position < index->offsets[record + 1])
+        {
+            size_t length = index->offsets[record + 1] - position;
+            ssize_t bytes_read = pread(index->data_fd, buf, (length < sizeof(buf)) ? length : sizeof(buf), position);
+
+            if (bytes_read <= 0)
+            {
+                perror("Record verify read");
+                syslog(LOG_ERR, "Record verify read failed");
+                return -1;
+            }
+            crc = crc32c(crc, buf, bytes_read);
+            position += bytes_read;
+        }
+
+        if (crc != check->crc)
+        {
+            syslog(LOG_ERR, "Record %zu is corrupt, crc32c 0x%08x expected 0x%08x", record, crc, check->crc);
+            check->flags |= RECORD_CHECK_CORRUPT;
+            corrupt++;
+        }
+        else if (mark_verified)
+        {
+            check->flags |= RECORD_CHECK_VERIFIED;
+        }
+    }
+    return corrupt;
+}
+
+/**
+ * Releases the memory and the persisted index file descriptor held by @param index
+ */
+void record_index_free(record_index_t *index)
+{
+    if (index->persist_fd != -1)
+        close(index->persist_fd);
+    index->persist_fd = -1;
+
+    free(index->offsets);
+    index->offsets = NULL;
+    free(index->checks);
+    index->checks = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
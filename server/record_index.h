@@ -0,0 +1,92 @@
+/**
+ * @file    record_index.h
+ * @brief   Record number to byte offset index for the file backed data store
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  In file mode there is no driver to resolve AESDCHAR_IOCSEEKTO:X,Y
+ * so the server keeps the start offset of every newline terminated record that
+ * was appended to the data file. Seeks become an O(1) array lookup followed by a
+ * positional read of the data file. The index can optionally be persisted to a
+ * side file so that a restart does not have to rescan the whole data file.
+ *
+ * When checksums are enabled the CRC-32C of every record is kept next to its offset
+ * and persisted with it. Records are verified lazily, the first time they are read
+ * back, and a verified record is not checked again. A corrupt record is reported
+ * once and then skipped by later verifications.
+ *
+ * Any necessary locking must be performed by the caller.
+ */
+
+#ifndef RECORD_INDEX_H
+#define RECORD_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define RECORD_CHECK_PRESENT (0x1)   // crc holds the CRC-32C of the record
+#define RECORD_CHECK_VERIFIED (0x2)  // Record was read back and matched, memory only
+#define RECORD_CHECK_CORRUPT (0x4)   // Record was read back and did not match, memory only
+
+typedef struct record_check
+{
+    uint32_t crc;
+    uint32_t flags;
+} record_check_t;
+
+typedef struct record_index
+{
+    /**
+     * offsets[i] is the byte offset of record i in the data file, offsets[count]
+     * is the start of the record which is still being received
+     */
+    off_t *offsets;
+    /**
+     * checks[i] is the integrity information for record i
+     */
+    record_check_t *checks;
+    /**
+     * Number of complete (newline terminated) records in the data file
+     */
+    size_t count;
+    /**
+     * Number of elements allocated in offsets
+     */
+    size_t capacity;
+    /**
+     * Total number of bytes appended to the data file
+     */
+    off_t data_size;
+    /**
+     * File descriptor of the data file, owned by the caller and used for verification
+     */
+    int data_fd;
+    /**
+     * File descriptor of the persisted index or -1 when the index is memory only
+     */
+    int persist_fd;
+    /**
+     * Compute a CRC-32C for every new record
+     */
+    bool checksums;
+    /**
+     * Running CRC-32C of the record which is still being received
+     */
+    uint32_t pending_crc;
+} record_index_t;
+
+extern int record_index_init(record_index_t *index, int data_fd, const char *persist_path, bool checksums);
+
+extern int record_index_append(record_index_t *index, const char *data, size_t length);
+
+extern int record_index_lookup(const record_index_t *index, uint32_t record,
+            uint32_t record_offset, off_t *position_rtn);
+
+extern size_t record_index_find(const record_index_t *index, off_t position);
+
+extern int record_index_verify(record_index_t *index, size_t first, size_t last, bool mark_verified);
+
+extern void record_index_free(record_index_t *index);
+
+#endif /* RECORD_INDEX_H */
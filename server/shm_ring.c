@@ -0,0 +1,500 @@
+/**
+ * @file    shm_ring.c
+ * @brief   Shared memory multi producer ring used by same host producers
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  See shm_ring.h for the ring protocol. Both the server and the local
+ * producers link this file, the server creates the ring and producers attach to it.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include "shm_ring.h"
+
+#define SHM_RING_SLOT_HEADER (8)
+#define SHM_RING_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+#define SHM_RING_COMMITTED (0x80000000u)
+#define SHM_RING_PADDING (0x40000000u)
+#define SHM_RING_LENGTH_MASK (0x3fffffffu)
+#define SHM_RING_DATA_OFFSET (4096)  // Data area starts on its own page
+#define SHM_RING_STALL_MS (1000)  // A reserved slot left uncommitted this long belongs to a dead producer
+
+/******************Slot header placed in front of every record******************/
+struct shm_ring_slot
+{
+    _Atomic uint32_t state;  // 0 until committed, then COMMITTED | flags | length
+    uint32_t reserved;
+};
+
+
+/* Description: Returns the slot header at ring position pos
+ */
+static struct shm_ring_slot *shm_ring_slot_at(const shm_ring_t *ring, uint64_t pos)
+{
+    return (struct shm_ring_slot *) (ring->data + (pos & (ring->data_size - 1)));
+}
+
+/* Description: Maps the memfd of a ring which was sized by shm_ring_create()
+ */
+static int shm_ring_map(shm_ring_t *ring, size_t map_size)
+{
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        perror("Shared ring mmap");
+        syslog(LOG_ERR, "Shared ring mmap failed");
+        return -1;
+    }
+
+    ring->header = map;
+    ring->data = (char *) map + SHM_RING_DATA_OFFSET;
+    ring->map_size = map_size;
+    ring->data_size = map_size - SHM_RING_DATA_OFFSET;
+    return 0;
+}
+
+/**
+ * Creates a ring with @param data_size bytes of record space, which must be a power of two.
+ * Return value: 0 on success, -1 on failure
+ */
+int shm_ring_create(shm_ring_t *ring, size_t data_size)
+{
+    memset(ring, 0, sizeof(shm_ring_t));
+    ring->memfd = -1;
+    ring->eventfd = -1;
+
+    if ((data_size == 0) || ((data_size & (data_size - 1)) != 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring->memfd = memfd_create("aesdsocket-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (ring->memfd == -1)
+    {
+        perror("memfd_create");
+        syslog(LOG_ERR, "memfd_create failed");
+        return -1;
+    }
+
+    if (ftruncate(ring->memfd, SHM_RING_DATA_OFFSET + data_size) == -1)
+    {
+        perror("Shared ring ftruncate");
+        syslog(LOG_ERR, "Shared ring ftruncate failed");
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    // Producers must not be able to shrink the mapping from under the server
+    fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    ring->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ring->eventfd == -1)
+    {
+        perror("eventfd");
+        syslog(LOG_ERR, "eventfd failed");
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    if (shm_ring_map(ring, SHM_RING_DATA_OFFSET + data_size) != 0)
+    {
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    ring->header->magic = SHM_RING_MAGIC;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->data_size = data_size;
+    atomic_init(&ring->header->head, 0);
+    atomic_init(&ring->header->tail, 0);
+    atomic_init(&ring->header->consumer_sleeping, 0);
+    return 0;
+}
+
+/**
+ * Attaches @param ring to the ring behind @param memfd, signalling the server through @param eventfd.
+ * Ownership of both file descriptors passes to the ring.
+ * Return value: 0 on success, -1 on failure
+ */
+int shm_ring_attach(shm_ring_t *ring, int memfd, int eventfd)
+{
+    struct stat st;
+
+    memset(ring, 0, sizeof(shm_ring_t));
+    ring->memfd = memfd;
+    ring->eventfd = eventfd;
+
+    if ((fstat(memfd, &st) == -1) || (st.st_size <= SHM_RING_DATA_OFFSET))
+    {
+        errno = EINVAL;
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    if (shm_ring_map(ring, st.st_size) != 0)
+    {
+        shm_ring_close(ring);
+        return -1;
+    }
+
+    if ((ring->header->magic != SHM_RING_MAGIC) || (ring->header->version != SHM_RING_VERSION) ||
+        (ring->header->data_size != ring->data_size))
+    {
+        syslog(LOG_ERR, "Shared ring header mismatch");
+        errno = EPROTO;
+        shm_ring_close(ring);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Connects to the aesdsocket UNIX socket at @param socket_path, requests the ring
+ * file descriptors and attaches @param ring to them.
+ * Return value: 0 on success, -1 on failure
+ */
+int shm_ring_connect(shm_ring_t *ring, const char *socket_path)
+{
+    struct sockaddr_un addr;
+    char byte;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    int fds[2];
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (socket_fd == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    if ((connect(socket_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) ||
+        (send(socket_fd, SHM_RING_ATTACH_STRING, strlen(SHM_RING_ATTACH_STRING), 0) == -1))
+    {
+        close(socket_fd);
+        return -1;
+    }
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) != 1)
+    {
+        close(socket_fd);
+        errno = EPROTO;
+        return -1;
+    }
+    close(socket_fd);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) ||
+        (cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int))))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    return shm_ring_attach(ring, fds[0], fds[1]);
+}
+
+/**
+ * Sends the memfd and eventfd of @param ring over the UNIX socket @param socket_fd
+ * Return value: 0 on success, -1 on failure
+ */
+int shm_ring_send_fds(const shm_ring_t *ring, int socket_fd)
+{
+    char byte = 0;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    int fds[2] = { ring->memfd, ring->eventfd };
+
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) != 1)
+    {
+        perror("Shared ring sendmsg");
+        syslog(LOG_ERR, "Shared ring sendmsg failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Returns the largest record which can be passed to shm_ring_produce() on @param ring
+ */
+size_t shm_ring_max_record(const shm_ring_t *ring)
+{
+    size_t max_record = (ring->data_size / 2) - SHM_RING_SLOT_HEADER;
+
+    return (max_record < SHM_RING_LENGTH_MASK) ? max_record : SHM_RING_LENGTH_MASK;
+}
+
+/**
+ * Appends @param length bytes from @param data to @param ring as one record.
+ * Safe to call concurrently from any number of threads and processes.
+ * Return value: 0 on success, -1 with errno EAGAIN when the ring is full,
+ * EMSGSIZE when the record is larger than shm_ring_max_record() or EPIPE when the
+ * server abandoned the ring, producers then attach again to get its replacement
+ */
+int shm_ring_produce(shm_ring_t *ring, const char *data, size_t length)
+{
+    struct shm_ring_header *header = ring->header;
+    size_t slot_size = SHM_RING_ALIGN(SHM_RING_SLOT_HEADER + length);
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    uint64_t tail;
+    size_t offset;
+    size_t padding;
+    struct shm_ring_slot *slot;
+
+    if (header->magic != SHM_RING_MAGIC)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+
+    if ((length == 0) || (length > shm_ring_max_record(ring)))
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    // Reserve the slot, plus a padding slot if the record would cross the end of the ring
+    do
+    {
+        offset = head & (ring->data_size - 1);
+        padding = ((offset + slot_size) > ring->data_size) ? (ring->data_size - offset) : 0;
+        tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+
+        if ((head + padding + slot_size - tail) > ring->data_size)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&header->head, &head, head + padding + slot_size,
+                memory_order_relaxed, memory_order_relaxed));
+
+    if (padding != 0)
+    {
+        slot = shm_ring_slot_at(ring, head);
+        atomic_store_explicit(&slot->state, SHM_RING_COMMITTED | SHM_RING_PADDING | padding,
+                memory_order_release);
+        head += padding;
+    }
+
+    slot = shm_ring_slot_at(ring, head);
+    memcpy((char *) slot + SHM_RING_SLOT_HEADER, data, length);
+    atomic_store_explicit(&slot->state, SHM_RING_COMMITTED | length, memory_order_release);
+
+    // Pairs with the fence in shm_ring_wait() so a sleeping consumer always gets woken
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&header->consumer_sleeping, memory_order_relaxed))
+        shm_ring_wake(ring);
+
+    return 0;
+}
+
+/* Description: Returns the monotonic clock in milliseconds
+ */
+static uint64_t shm_ring_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+/* Description: Returns true if the uncommitted slot at tail of the ring has been reserved
+ * for SHM_RING_STALL_MS already, which only happens when its producer died
+ */
+static bool shm_ring_stalled(shm_ring_t *ring, uint64_t tail)
+{
+    uint64_t now = shm_ring_now_ms();
+
+    if (tail == atomic_load_explicit(&ring->header->head, memory_order_acquire))
+    {
+        ring->stall_since = 0;
+        return false;
+    }
+
+    if ((ring->stall_since == 0) || (ring->stall_tail != tail))
+    {
+        ring->stall_tail = tail;
+        ring->stall_since = now;
+        return false;
+    }
+    return (now - ring->stall_since) >= SHM_RING_STALL_MS;
+}
+
+/**
+ * Copies committed records from @param ring to @param out, stopping at the first record
+ * which is not yet committed or which does not fit in @param out_size bytes.
+ * Slot headers are written by producers and checked before they are trusted.
+ * Must only be called by the single consumer, out_size must be at least shm_ring_max_record().
+ * Return value: number of bytes copied, 0 if no record was committed, -1 with errno
+ * EPROTO when a slot header is corrupt or ETIMEDOUT when a producer died holding a
+ * reserved slot. The ring cannot be drained any further then, see shm_ring_abandon().
+ */
+ssize_t shm_ring_consume(shm_ring_t *ring, char *out, size_t out_size)
+{
+    struct shm_ring_header *header = ring->header;
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    uint64_t start = tail;
+    size_t copied = 0;
+
+    while (1)
+    {
+        struct shm_ring_slot *slot = shm_ring_slot_at(ring, tail);
+        uint32_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        size_t length = state & SHM_RING_LENGTH_MASK;
+        size_t room = ring->data_size - (tail & (ring->data_size - 1));
+        size_t slot_size;
+
+        if ((state & SHM_RING_COMMITTED) == 0)
+        {
+            if ((copied == 0) && shm_ring_stalled(ring, tail))
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            break;
+        }
+
+        if (state & SHM_RING_PADDING)
+            slot_size = length;
+        else if (length <= shm_ring_max_record(ring))
+            slot_size = SHM_RING_ALIGN(SHM_RING_SLOT_HEADER + length);
+        else
+            slot_size = 0;
+
+        // A slot must lie within the space reserved so far and never cross the end of the ring
+        if ((slot_size < SHM_RING_SLOT_HEADER) || (slot_size != SHM_RING_ALIGN(slot_size)) ||
+            (slot_size > room) ||
+            ((tail + slot_size) > atomic_load_explicit(&header->head, memory_order_acquire)))
+        {
+            // Records drained before the corrupt slot are returned first
+            if (copied != 0)
+                break;
+            syslog(LOG_ERR, "Shared ring slot at %llu is corrupt, state 0x%x",
+                    (unsigned long long) tail, state);
+            errno = EPROTO;
+            return -1;
+        }
+
+        if ((state & SHM_RING_PADDING) == 0)
+        {
+            if ((copied + length) > out_size)
+                break;
+            memcpy(out + copied, (char *) slot + SHM_RING_SLOT_HEADER, length);
+            copied += length;
+        }
+
+        // Stale bytes must never look like a committed slot header on the next lap
+        memset(slot, 0, slot_size);
+        tail += slot_size;
+    }
+
+    if (tail != start)
+        atomic_store_explicit(&header->tail, tail, memory_order_release);
+
+    return copied;
+}
+
+/**
+ * Makes every producer attached to @param ring fail with EPIPE from now on, then closes
+ * it. The server calls this once shm_ring_consume() found the ring unusable and hands a
+ * new ring to producers which attach again.
+ */
+void shm_ring_abandon(shm_ring_t *ring)
+{
+    if (ring->header != NULL)
+        ring->header->magic = 0;
+    shm_ring_close(ring);
+}
+
+/**
+ * Blocks the consumer of @param ring until a producer signals the eventfd or
+ * @param timeout_ms expires. Returns immediately when a record is already committed.
+ */
+void shm_ring_wait(shm_ring_t *ring, int timeout_ms)
+{
+    struct shm_ring_header *header = ring->header;
+    struct pollfd pfd = { .fd = ring->eventfd, .events = POLLIN };
+    uint64_t count;
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&header->consumer_sleeping, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if ((atomic_load_explicit(&shm_ring_slot_at(ring, tail)->state, memory_order_acquire) & SHM_RING_COMMITTED) == 0)
+    {
+        if ((poll(&pfd, 1, timeout_ms) > 0) && (read(ring->eventfd, &count, sizeof(count)) == -1))
+            syslog(LOG_DEBUG, "Shared ring eventfd read");
+    }
+
+    atomic_store_explicit(&header->consumer_sleeping, 0, memory_order_relaxed);
+}
+
+/**
+ * Signals the eventfd of @param ring, waking the consumer
+ */
+void shm_ring_wake(shm_ring_t *ring)
+{
+    uint64_t one = 1;
+
+    if (write(ring->eventfd, &one, sizeof(one)) == -1)
+        syslog(LOG_DEBUG, "Shared ring eventfd write");
+}
+
+/**
+ * Unmaps @param ring and closes its file descriptors
+ */
+void shm_ring_close(shm_ring_t *ring)
+{
+    if (ring->header != NULL)
+        munmap(ring->header, ring->map_size);
+    ring->header = NULL;
+    ring->data = NULL;
+
+    if (ring->memfd != -1)
+        close(ring->memfd);
+    ring->memfd = -1;
+
+    if (ring->eventfd != -1)
+        close(ring->eventfd);
+    ring->eventfd = -1;
+}
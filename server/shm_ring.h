@@ -0,0 +1,92 @@
+/**
+ * @file    shm_ring.h
+ * @brief   Shared memory multi producer ring used by same host producers
+ * @author  Aamir Suhail Burhan
+ *
+ * @description  aesdsocket owns a memfd backed byte ring and an eventfd. A local
+ * producer connects to the UNIX socket, sends SHM_RING_ATTACH_STRING and receives
+ * both file descriptors over SCM_RIGHTS. From then on records are appended with
+ * shm_ring_produce() without any syscall unless the server is asleep, in which case
+ * the eventfd is signalled. The server drains committed records into the same
+ * commit path used by socket clients.
+ *
+ * Ring protocol: producers reserve space by advancing head with a compare and swap,
+ * copy the record behind an 8 byte slot header and publish it by storing the slot
+ * state with release semantics. A record which would cross the end of the ring is
+ * preceded by a padding slot. The single consumer zeroes every slot it drains before
+ * releasing tail, so a slot header is only ever non zero once it is committed.
+ * Producers are not trusted: a corrupt slot header or a slot left reserved by a dead
+ * producer makes the server abandon the ring and create a new one.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define SHM_RING_ATTACH_STRING "AESDCHAR_SHMATTACH\n"
+#define SHM_RING_MAGIC (0x52534541)  // "AESR"
+#define SHM_RING_VERSION (1)
+#define SHM_RING_DEFAULT_SIZE (1024 * 1024)  // Must be a power of two
+#define SHM_RING_CACHE_LINE (64)
+
+struct shm_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Size in bytes of the data area, a power of two
+     */
+    uint64_t data_size;
+    /**
+     * Next byte to be reserved by a producer, free running
+     */
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t head;
+    /**
+     * First byte not yet drained by the consumer, free running
+     */
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint64_t tail;
+    /**
+     * Set by the consumer before it blocks on the eventfd
+     */
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t consumer_sleeping;
+};
+
+typedef struct shm_ring
+{
+    struct shm_ring_header *header;
+    char *data;             // Start of the data area inside the mapping
+    size_t data_size;
+    size_t map_size;
+    int memfd;
+    int eventfd;
+    uint64_t stall_tail;    // Consumer only, uncommitted slot seen at tail since stall_since
+    uint64_t stall_since;
+} shm_ring_t;
+
+extern int shm_ring_create(shm_ring_t *ring, size_t data_size);
+
+extern int shm_ring_attach(shm_ring_t *ring, int memfd, int eventfd);
+
+extern int shm_ring_connect(shm_ring_t *ring, const char *socket_path);
+
+extern int shm_ring_send_fds(const shm_ring_t *ring, int socket_fd);
+
+extern int shm_ring_produce(shm_ring_t *ring, const char *data, size_t length);
+
+extern ssize_t shm_ring_consume(shm_ring_t *ring, char *out, size_t out_size);
+
+extern void shm_ring_wait(shm_ring_t *ring, int timeout_ms);
+
+extern void shm_ring_wake(shm_ring_t *ring);
+
+extern size_t shm_ring_max_record(const shm_ring_t *ring);
+
+extern void shm_ring_abandon(shm_ring_t *ring);
+
+extern void shm_ring_close(shm_ring_t *ring);
+
+#endif /* SHM_RING_H */